@@ -0,0 +1,200 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <epoller.h>
+#include <functional>
+#include <logger.h>
+#include <memory>
+#include <netinet/in.h>
+#include <notify_event_fd.h>
+#include <socket_descriptor.h>
+#include <spsc_ring.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <threadsafe_queue.h>
+#include <unistd.h>
+#include <vector>
+
+// Connection rate of the accept modes of the server, with a trivial handler:
+// read the request, answer with a fixed response and close.
+//   queue per conn: one thread accepts and hands each fd to a worker through
+//                   a threadsafe_queue and an eventfd write, as WebServer did
+//                   before batching
+//   batched ring:   one thread accepts a batch, pushes into per-worker SPSC
+//                   rings and writes each woken worker's eventfd once, as
+//                   WebServer does by default
+//   reuse_port:     every worker accepts on its own SO_REUSEPORT listener
+// Clients open a connection per request, so accept is on the critical path.
+// usage: bench_accept [workers] [clients] [seconds] [port]
+
+static const std::string kRequest = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const std::string kResponse =
+    "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-length: 2\r\n\r\nok";
+
+struct Worker {
+    Epoller epoller;
+    NotifyEventFd notify;
+    threadsafe_queue<int> queue;
+    SpscRing<int, 1024> ring;
+    std::unique_ptr<ServerSocket> listen_sock;
+    std::jthread thread;
+};
+
+static void Serve(int fd) {
+    char buf[1024];
+    if (read(fd, buf, sizeof(buf)) > 0) {
+        send(fd, kResponse.data(), kResponse.size(), MSG_NOSIGNAL);
+    }
+    close(fd);
+}
+
+static void AcceptAll(int listen_fd, const std::function<void(int)> &on_conn) {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        on_conn(fd);
+    }
+}
+
+static void RunWorker(Worker &worker, bool batched, const std::atomic<bool> &stop) {
+    while (!stop.load(std::memory_order_relaxed)) {
+        int n = worker.epoller.Wait(100);
+        for (int i = 0; i < n; i++) {
+            int fd = worker.epoller.GetEventFd(i);
+            if (worker.listen_sock && fd == worker.listen_sock->get()) {
+                AcceptAll(fd, [&](int conn) { worker.epoller.AddFd(conn, EPOLLIN | EPOLLONESHOT); });
+            } else if (fd == worker.notify.Get() && batched) {
+                worker.notify.Read();
+                int conn;
+                while (worker.ring.TryPop(conn)) {
+                    worker.epoller.AddFd(conn, EPOLLIN | EPOLLONESHOT);
+                }
+            } else if (fd == worker.notify.Get()) {
+                auto num = worker.notify.Read();
+                for (uint64_t j = 0; j < num; j++) {
+                    worker.epoller.AddFd(worker.queue.dequeue(), EPOLLIN | EPOLLONESHOT);
+                }
+            } else {
+                worker.epoller.DelFd(fd);
+                Serve(fd);
+            }
+        }
+    }
+}
+
+// clients connect, send one request, read to EOF and start over
+static size_t RunClients(int port, int clients, std::chrono::seconds duration) {
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> done{0};
+    std::vector<std::jthread> threads;
+    for (int i = 0; i < clients; i++) {
+        threads.emplace_back([&] {
+            struct sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(port);
+            char buf[256];
+            size_t count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0
+                    && send(fd, kRequest.data(), kRequest.size(), MSG_NOSIGNAL) > 0) {
+                    while (read(fd, buf, sizeof(buf)) > 0) {}
+                    count++;
+                }
+                close(fd);
+            }
+            done.fetch_add(count);
+        });
+    }
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    threads.clear();
+    return done.load();
+}
+
+enum class MODE { QUEUE_PER_CONN, BATCHED_RING, REUSE_PORT };
+
+static void Bench(const char *name, MODE mode, int workers_n, int clients, int seconds, int port) {
+    bool reuse_port = mode == MODE::REUSE_PORT;
+    bool batched = mode == MODE::BATCHED_RING;
+    std::atomic<bool> stop{false};
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < workers_n; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->epoller.AddFd(worker->notify.Get(), EPOLLIN);
+        if (reuse_port) {
+            worker->listen_sock = std::make_unique<ServerSocket>();
+            worker->listen_sock->listenTo(port, 10000, true);
+            worker->epoller.AddFd(worker->listen_sock->get(), EPOLLIN | EPOLLET);
+        }
+        workers.push_back(std::move(worker));
+    }
+    for (auto &worker : workers) {
+        worker->thread = std::jthread([&stop, batched, w = worker.get()] { RunWorker(*w, batched, stop); });
+    }
+
+    std::jthread acceptor;
+    if (!reuse_port) {
+        acceptor = std::jthread([&] {
+            ServerSocket listen_sock;
+            listen_sock.listenTo(port, 10000);
+            Epoller epoller;
+            epoller.AddFd(listen_sock.get(), EPOLLIN | EPOLLET);
+            size_t next = 0;
+            std::vector<char> woken(workers.size());
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (epoller.Wait(100) <= 0) {
+                    continue;
+                }
+                AcceptAll(listen_sock.get(), [&](int conn) {
+                    size_t idx = next++ % workers.size();
+                    auto &worker = *workers[idx];
+                    if (!batched) {
+                        worker.queue.enqueue(std::move(conn));
+                        worker.notify.Write(1);
+                    } else if (worker.ring.TryPush(conn)) {
+                        woken[idx] = true;
+                    } else {
+                        close(conn);
+                    }
+                });
+                for (size_t i = 0; i < woken.size(); i++) {
+                    if (woken[i]) {
+                        woken[i] = false;
+                        workers[i]->notify.Write(1);
+                    }
+                }
+            }
+        });
+        // let the listener come up before the clients connect
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    size_t conns = RunClients(port, clients, std::chrono::seconds(seconds));
+    stop = true;
+    acceptor = {};
+    for (auto &worker : workers) {
+        worker->thread = {};
+    }
+    spdlog::info("{:<16} {:>10.0f} connections/s", name, static_cast<double>(conns) / seconds);
+}
+
+int main(int argc, char *argv[]) {
+    int workers = argc > 1 ? std::stoi(argv[1]) : 4;
+    int clients = argc > 2 ? std::stoi(argv[2]) : 32;
+    int seconds = argc > 3 ? std::stoi(argv[3]) : 3;
+    int port = argc > 4 ? std::stoi(argv[4]) : 19000;
+    // the server classes log through logger, keep them quiet
+    logger = std::make_shared<spdlog::logger>("bench_accept");
+
+    spdlog::info("{} workers, {} clients, {} s per mode", workers, clients, seconds);
+    Bench("queue per conn", MODE::QUEUE_PER_CONN, workers, clients, seconds, port);
+    Bench("batched ring", MODE::BATCHED_RING, workers, clients, seconds, port + 1);
+    Bench("reuse_port", MODE::REUSE_PORT, workers, clients, seconds, port + 2);
+}
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <dispatch_policy.h>
+#include <memory>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <vector>
+
+// Dispatch policies under a skewed workload, simulated in ticks so that runs
+// are repeatable and independent of the machine.
+//
+// Connections arrive in bursts shaped like page loads: a page and its assets
+// are short-lived, but every burst starts with a connection that turns into a
+// long download a third of the time. Bursts as long as the worker count line
+// the downloads up on the same worker under round-robin. Every tick the
+// workers pick up the connections handed to them, publish their load as
+// ServerHandler does, and drop the connections that are done.
+// usage: bench_dispatch [workers] [ticks]
+
+struct SimWorker {
+    WorkerLoad load;
+    // remaining lifetime of every live connection, in ticks
+    std::vector<int> conns;
+    std::deque<int> queue;
+};
+
+static constexpr int kDownloadTicks = 3000;
+
+static void Simulate(const char *name, DISPATCH_POLICY policy, int workers_n, int ticks) {
+    std::vector<std::unique_ptr<SimWorker>> workers;
+    std::vector<WorkerLoad *> loads;
+    for (int i = 0; i < workers_n; i++) {
+        workers.push_back(std::make_unique<SimWorker>());
+        loads.push_back(&workers.back()->load);
+    }
+    Dispatcher dispatcher(policy);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> bursts(0, 3);
+    std::uniform_int_distribution<int> short_life(1, 3);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    double imbalance_sum = 0;
+    size_t peak = 0;
+    size_t peak_downloads = 0;
+    int measured = 0;
+    for (int tick = 0; tick < ticks; tick++) {
+        for (auto &worker : workers) {
+            while (!worker->queue.empty()) {
+                worker->conns.push_back(worker->queue.front());
+                worker->queue.pop_front();
+            }
+            worker->load.pending.store(0, std::memory_order_relaxed);
+            worker->load.events.store(worker->conns.size(), std::memory_order_relaxed);
+            for (auto &life : worker->conns) {
+                life--;
+            }
+            std::erase_if(worker->conns, [](int life) { return life <= 0; });
+            worker->load.connections.store(worker->conns.size(), std::memory_order_relaxed);
+        }
+
+        for (int burst = bursts(rng); burst > 0; burst--) {
+            for (int i = 0; i < workers_n; i++) {
+                bool download = i == 0 && percent(rng) < 33;
+                auto &worker = *workers[dispatcher.Select(loads)];
+                worker.queue.push_back(download ? kDownloadTicks : short_life(rng));
+                worker.load.pending.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        if (tick < kDownloadTicks) {
+            continue;
+        }
+        size_t most = 0;
+        size_t total = 0;
+        for (auto &worker : workers) {
+            size_t conns = worker->conns.size();
+            most = std::max(most, conns);
+            total += conns;
+            size_t downloads = std::count_if(worker->conns.begin(), worker->conns.end(),
+                                             [](int life) { return life > 3; });
+            peak_downloads = std::max(peak_downloads, downloads);
+        }
+        if (total > 0) {
+            imbalance_sum += static_cast<double>(most) * workers_n / total;
+            measured++;
+        }
+        peak = std::max(peak, most);
+    }
+    spdlog::info("{:<22} busiest/mean {:>5.2f}, peak connections {:>5}, peak downloads on one worker {:>4}",
+                 name, measured ? imbalance_sum / measured : 0.0, peak, peak_downloads);
+}
+
+// cost of one Select() over loads that change under it
+static void SelectCost(const char *name, DISPATCH_POLICY policy, int workers_n) {
+    std::vector<std::unique_ptr<WorkerLoad>> owned;
+    std::vector<WorkerLoad *> loads;
+    for (int i = 0; i < workers_n; i++) {
+        owned.push_back(std::make_unique<WorkerLoad>());
+        loads.push_back(owned.back().get());
+    }
+    Dispatcher dispatcher(policy);
+    constexpr int kSelects = 1000000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kSelects; i++) {
+        auto &load = *loads[dispatcher.Select(loads)];
+        load.connections.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    spdlog::info("{:<22} {:>6.1f} ns/select", name, elapsed.count() / kSelects);
+}
+
+int main(int argc, char *argv[]) {
+    int workers = argc > 1 ? std::stoi(argv[1]) : 12;
+    int ticks = argc > 2 ? std::stoi(argv[2]) : 20000;
+    std::array<std::pair<const char *, DISPATCH_POLICY>, 4> policies{{
+        {"round robin", DISPATCH_POLICY::ROUND_ROBIN},
+        {"least connections", DISPATCH_POLICY::LEAST_CONNECTIONS},
+        {"power of two choices", DISPATCH_POLICY::POWER_OF_TWO_CHOICES},
+        {"queue depth weighted", DISPATCH_POLICY::QUEUE_DEPTH_WEIGHTED},
+    }};
+    spdlog::info("{} workers, {} ticks", workers, ticks);
+    for (auto [name, policy] : policies) {
+        Simulate(name, policy, workers, ticks);
+    }
+    for (auto [name, policy] : policies) {
+        SelectCost(name, policy, workers);
+    }
+}
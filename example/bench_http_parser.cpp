@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <chrono>
+#include <http_parser.h>
+#include <regex>
+#include <simd_scan.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <unordered_map>
+
+// Compares the previous std::regex based request parsing with HttpParser.
+// Each request is parsed whole and once more split into small chunks, as it
+// arrives over several EPOLLIN events.
+
+static const std::string kRequest =
+    "GET /images/profile-image.jpg HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8888\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:126.0) Gecko/20100101 Firefox/126.0\r\n"
+    "Accept: image/avif,image/webp,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://127.0.0.1:8888/picture.html\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+    "\r\n";
+
+// the line based parser HttpRequest used before: complete lines are consumed,
+// a partial line is scanned again from its start when more data arrives
+struct RegexParser {
+    std::string method, path, version;
+    std::unordered_map<std::string, std::string> header;
+    bool request_line = true;
+
+    // returns true once the empty line ending the head was consumed
+    bool Parse(const char *&begin, const char *end) {
+        const std::string CRLF = "\r\n";
+        while (begin < end) {
+            const char *line_end = std::search(begin, end, CRLF.begin(), CRLF.end());
+            if (line_end == end) {
+                return false;
+            }
+            std::string line(begin, line_end);
+            begin = line_end + 2;
+            if (request_line) {
+                std::regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+                std::smatch sub_match;
+                if (!std::regex_match(line, sub_match, pattern)) { return false; }
+                method = sub_match[1];
+                path = sub_match[2];
+                version = sub_match[3];
+                request_line = false;
+            } else if (line.empty()) {
+                return true;
+            } else {
+                std::regex pattern("^([^:]*): ?(.*)$");
+                std::smatch sub_match;
+                if (!std::regex_match(line, sub_match, pattern)) { return false; }
+                header[sub_match[1]] = sub_match[2];
+            }
+        }
+        return false;
+    }
+};
+
+static bool ChunkedRegexParse(const std::string &req, size_t chunk) {
+    RegexParser parser;
+    const char *begin = req.data();
+    for (size_t avail = chunk; avail < req.size(); avail += chunk) {
+        parser.Parse(begin, req.data() + avail);
+    }
+    return parser.Parse(begin, req.data() + req.size());
+}
+
+static bool ChunkedParse(HttpParser &parser, const std::string &req, size_t chunk) {
+    parser.Reset();
+    for (size_t avail = chunk; avail < req.size(); avail += chunk) {
+        parser.Parse(req.data(), req.data() + avail);
+    }
+    return parser.Parse(req.data(), req.data() + req.size())
+           == HttpParser::PARSE_STATUS::COMPLETE;
+}
+
+// a request with a 16KB cookie header
+static std::string BigCookieRequest() {
+    std::string cookie(16 * 1024, 'x');
+    for (size_t i = 0; i < cookie.size(); i += 40) {
+        cookie[i] = '=';
+        cookie[i + 20] = ';';
+    }
+    return "GET / HTTP/1.1\r\nHost: 127.0.0.1:8888\r\nCookie: " + cookie
+           + "\r\nConnection: keep-alive\r\n\r\n";
+}
+
+template <typename F>
+static void Bench(const char *name, int iterations, F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (!f()) {
+            spdlog::error("{}: parse failed", name);
+            return;
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    spdlog::info("{:<24} {:>10.1f} ns/request", name, static_cast<double>(ns) / iterations);
+}
+
+int main() {
+    // constructing the regexes dominates the old path, it gets fewer rounds
+    const int regex_iterations = 2000;
+    const int iterations = 200000;
+    const size_t chunk = 64;
+    HttpParser parser;
+
+    Bench("regex", regex_iterations, [] {
+        RegexParser regex_parser;
+        const char *begin = kRequest.data();
+        return regex_parser.Parse(begin, kRequest.data() + kRequest.size());
+    });
+    Bench("HttpParser", iterations, [&] {
+        parser.Reset();
+        return parser.Parse(kRequest.data(), kRequest.data() + kRequest.size())
+               == HttpParser::PARSE_STATUS::COMPLETE;
+    });
+    Bench("regex (64B chunks)", regex_iterations, [&] {
+        return ChunkedRegexParse(kRequest, chunk);
+    });
+    Bench("HttpParser (64B chunks)", iterations, [&] {
+        return ChunkedParse(parser, kRequest, chunk);
+    });
+
+    const std::string big = BigCookieRequest();
+    Bench("regex, cookie (512B)", 200, [&] {
+        return ChunkedRegexParse(big, 512);
+    });
+    Bench("HttpParser, cookie (512B)", 20000, [&] {
+        return ChunkedParse(parser, big, 512);
+    });
+
+    // raw delimiter scanning over the cookie line
+    spdlog::info("FindFirstOf uses {}", kFindFirstOf.name);
+    const char *line = big.data() + big.find("Cookie");
+    const char *line_end = big.data() + big.size();
+    auto scan = [&](FindFirstOfFn fn) {
+        return [=] { return *fn(line, line_end, '\r', '\n', '\n') == '\r'; };
+    };
+    Bench("scan scalar", 20000, scan(FindFirstOfScalar));
+#if defined(__x86_64__) || defined(__i386__)
+    Bench("scan sse2", 20000, scan(FindFirstOfSse2));
+    if (__builtin_cpu_supports("avx2")) {
+        Bench("scan avx2", 20000, scan(FindFirstOfAvx2));
+    }
+#endif
+}
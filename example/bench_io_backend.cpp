@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <epoller.h>
+#include <logger.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Keep-alive load against a running server, to compare the workers' io
+// backends side by side:
+//   MINISERVER_IO_BACKEND=EPOLL    ./main
+//   MINISERVER_IO_BACKEND=IO_URING ./main
+// Every connection sends one request, waits for the whole response and sends
+// the next, so the number of connections is the number of requests in
+// flight. Reports requests per second and latency percentiles. Open at most
+// as many connections as `ulimit -n` allows, on both sides.
+// usage: bench_io_backend [connections] [seconds] [threads] [port] [path]
+
+using Clock = std::chrono::steady_clock;
+
+struct Client {
+    int fd = -1;
+    std::string in;
+    Clock::time_point sent;
+};
+
+struct Result {
+    size_t requests = 0;
+    size_t errors = 0;
+    std::vector<uint32_t> latency_us;
+};
+
+// length of the first complete response in in, 0 if there is none yet
+static size_t ResponseLength(std::string_view in) {
+    size_t head_end = in.find("\r\n\r\n");
+    if (head_end == std::string_view::npos) {
+        return 0;
+    }
+    size_t body = 0;
+    std::string_view head = in.substr(0, head_end);
+    for (std::string_view name : {"Content-Length: ", "Content-length: "}) {
+        if (size_t pos = head.find(name); pos != std::string_view::npos) {
+            const char *begin = head.data() + pos + name.size();
+            std::from_chars(begin, head.data() + head.size(), body);
+            break;
+        }
+    }
+    size_t total = head_end + 4 + body;
+    return in.size() >= total ? total : 0;
+}
+
+static int Connect(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void Run(int connections, std::chrono::seconds duration, int port,
+                const std::string &request, Result &result) {
+    Epoller epoller(4096);
+    std::vector<Client> clients(connections);
+    for (auto &client : clients) {
+        client.fd = Connect(port);
+        if (client.fd < 0) {
+            result.errors++;
+            continue;
+        }
+        // the request is sent once the connection is writable
+        epoller.AddFd(client.fd, EPOLLOUT | EPOLLONESHOT, &client);
+    }
+    auto end = Clock::now() + duration;
+    char buf[64 * 1024];
+    while (Clock::now() < end) {
+        int n = epoller.Wait(100);
+        auto now = Clock::now();
+        for (int i = 0; i < n; i++) {
+            auto &client = *static_cast<Client *>(epoller.GetEventPtr(i));
+            uint32_t events = epoller.GetEvents(i);
+            if (events & (EPOLLERR | EPOLLHUP)) {
+                result.errors++;
+                epoller.DelFd(client.fd);
+                close(client.fd);
+                continue;
+            }
+            if (events & EPOLLOUT) {
+                client.sent = now;
+                send(client.fd, request.data(), request.size(), MSG_NOSIGNAL);
+                epoller.ModFd(client.fd, EPOLLIN, &client);
+                continue;
+            }
+            ssize_t len;
+            while ((len = recv(client.fd, buf, sizeof(buf), 0)) > 0) {
+                client.in.append(buf, len);
+            }
+            if (len == 0) {
+                result.errors++;
+                epoller.DelFd(client.fd);
+                close(client.fd);
+                continue;
+            }
+            while (size_t total = ResponseLength(client.in)) {
+                client.in.erase(0, total);
+                result.requests++;
+                result.latency_us.push_back(static_cast<uint32_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(now - client.sent).count()));
+                client.sent = now;
+                send(client.fd, request.data(), request.size(), MSG_NOSIGNAL);
+            }
+        }
+    }
+    for (auto &client : clients) {
+        if (client.fd >= 0) {
+            close(client.fd);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // Epoller logs through logger, keep it quiet
+    logger = std::make_shared<spdlog::logger>("bench_io_backend");
+    int connections = argc > 1 ? std::atoi(argv[1]) : 1000;
+    auto duration = std::chrono::seconds(argc > 2 ? std::atoi(argv[2]) : 10);
+    int threads = argc > 3 ? std::atoi(argv[3]) : 1;
+    int port = argc > 4 ? std::atoi(argv[4]) : 8888;
+    std::string path = argc > 5 ? argv[5] : "/index.html";
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    std::vector<Result> results(threads);
+    {
+        std::vector<std::jthread> runners;
+        for (int i = 0; i < threads; i++) {
+            int share = connections / threads + (i < connections % threads ? 1 : 0);
+            runners.emplace_back([&, i, share] { Run(share, duration, port, request, results[i]); });
+        }
+    }
+
+    Result total;
+    for (auto &result : results) {
+        total.requests += result.requests;
+        total.errors += result.errors;
+        total.latency_us.insert(total.latency_us.end(), result.latency_us.begin(), result.latency_us.end());
+    }
+    std::sort(total.latency_us.begin(), total.latency_us.end());
+    auto percentile = [&](double p) -> double {
+        if (total.latency_us.empty()) {
+            return 0;
+        }
+        return total.latency_us[static_cast<size_t>(p * (total.latency_us.size() - 1))] / 1000.0;
+    };
+    std::printf("%d connections, %lld s: %.0f req/s, errors %zu, latency p50 %.2f ms, p99 %.2f ms\n",
+                connections, static_cast<long long>(duration.count()),
+                static_cast<double>(total.requests) / duration.count(), total.errors,
+                percentile(0.5), percentile(0.99));
+}
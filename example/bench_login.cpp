@@ -0,0 +1,77 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mysql++/mysql++.h>
+#include <sqlconnpool.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Login lookups per second against the database the server is configured
+// with (MINISERVER_DB_* environment variables), first with the query built
+// as text and quoted on every call, as UserVerify did, then with the
+// prepared statement it uses now. Each thread holds a pooled connection per
+// lookup, like a DbExecutor thread.
+// usage: bench_login [threads] [seconds]
+
+static const std::string kName = "bench_login";
+static const std::string kPassword = "bench_login";
+
+static bool TextLogin(MySqlScopedConnection &conn) {
+    auto query = conn->query();
+    query << "SELECT password FROM user WHERE username = " << mysqlpp::quote << kName << " LIMIT 1";
+    mysqlpp::StoreQueryResult result = query.store();
+    return result.num_rows() == 1 && std::string(result[0]["password"]) == kPassword;
+}
+
+static bool PreparedLogin(MySqlScopedConnection &conn) {
+    auto password = conn.Statement(SQL_STATEMENT::SELECT_PASSWORD).SelectString({kName});
+    return password == kPassword;
+}
+
+static void Run(const char *name, int threads, std::chrono::seconds duration,
+                const std::function<bool(MySqlScopedConnection &)> &login) {
+    std::atomic<size_t> logins{0};
+    std::atomic<size_t> failures{0};
+    auto end = std::chrono::steady_clock::now() + duration;
+    {
+        std::vector<std::jthread> runners;
+        for (int i = 0; i < threads; i++) {
+            runners.emplace_back([&] {
+                size_t done = 0;
+                size_t failed = 0;
+                while (std::chrono::steady_clock::now() < end) {
+                    MySqlScopedConnection conn(MysqlConnectionPool::GetInstance());
+                    if (!login(conn)) {
+                        failed++;
+                    }
+                    done++;
+                }
+                logins += done;
+                failures += failed;
+            });
+        }
+    }
+    std::printf("%-8s %d threads, %lld s: %.0f logins/s, failures %zu\n", name, threads,
+                static_cast<long long>(duration.count()),
+                static_cast<double>(logins) / duration.count(), failures.load());
+}
+
+int main(int argc, char *argv[]) {
+    int threads = argc > 1 ? std::atoi(argv[1]) : 4;
+    auto duration = std::chrono::seconds(argc > 2 ? std::atoi(argv[2]) : 10);
+    auto &pool = MysqlConnectionPool::GetInstance();
+    pool.Init(std::getenv("MINISERVER_DB_NAME"), std::getenv("MINISERVER_DB_HOST"),
+              std::getenv("MINISERVER_DB_USER"), std::getenv("MINISERVER_DB_PASSWORD"),
+              3306, std::chrono::seconds(3600), threads, threads);
+    {
+        MySqlScopedConnection conn(pool);
+        if (!conn.Statement(SQL_STATEMENT::SELECT_PASSWORD).SelectString({kName})) {
+            conn.Statement(SQL_STATEMENT::INSERT_USER).Execute({kName, kPassword});
+        }
+    }
+    Run("text", threads, duration, TextLogin);
+    Run("prepared", threads, duration, PreparedLogin);
+}
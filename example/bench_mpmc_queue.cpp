@@ -0,0 +1,110 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mpmc_blocking_q.h>
+#include <mutex>
+#include <queue>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Throughput of mpmc_blocking_queue against the mutex and condition variable
+// queue it replaced, with 1 to 32 producers and as many consumers sharing one
+// small queue. Every item is a number; the consumers' sum proves that each
+// one came out exactly once.
+// usage: bench_mpmc_queue [items per producer] [capacity]
+
+// the previous mpmc_blocking_queue, only the blocking calls
+template <typename T>
+class locked_queue {
+public:
+    explicit locked_queue(size_t max_items)
+        : max_items(max_items) {}
+
+    void enqueue(T&& item) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            pop_cv.wait(lock, [this] { return this->q.size() != max_items; });
+            q.push(std::move(item));
+        }
+        push_cv.notify_one();
+    }
+
+    void dequeue(T& popped_item) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            push_cv.wait(lock, [this] { return !q.empty(); });
+            popped_item = std::move(q.front());
+            q.pop();
+        }
+        pop_cv.notify_one();
+    }
+
+private:
+    std::mutex queue_mutex;
+    std::condition_variable push_cv;
+    std::condition_variable pop_cv;
+    std::queue<T> q;
+    size_t max_items{0};
+};
+
+template <typename Queue>
+static void Bench(const char *name, int threads, uint64_t items, size_t capacity) {
+    Queue queue(capacity);
+    std::atomic<uint64_t> sum{0};
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&queue, items] {
+                for (uint64_t i = 1; i <= items; i++) {
+                    uint64_t item = i;
+                    queue.enqueue(std::move(item));
+                }
+            });
+            workers.emplace_back([&queue, &sum, items] {
+                uint64_t local = 0;
+                for (uint64_t i = 0; i < items; i++) {
+                    uint64_t item;
+                    queue.dequeue(item);
+                    local += item;
+                }
+                sum += local;
+            });
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    uint64_t expected = threads * (items * (items + 1) / 2);
+    spdlog::info("{:<12} {:>2}P/{:>2}C {:>8.2f} M items/s{}", name, threads, threads,
+                 threads * items / elapsed.count() / 1e6, sum == expected ? "" : "  SUM MISMATCH");
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t items = argc > 1 ? std::stoull(argv[1]) : 200000;
+    size_t capacity = argc > 2 ? std::stoul(argv[2]) : 1024;
+    spdlog::info("{} items per producer, capacity {}", items, capacity);
+    for (int threads : {1, 2, 4, 8, 16, 32}) {
+        Bench<locked_queue<uint64_t>>("mutex+cv", threads, items, capacity);
+        Bench<mpmc_blocking_queue<uint64_t>>("lock-free", threads, items, capacity);
+    }
+
+    // the non-blocking policies keep their counters
+    mpmc_blocking_queue<uint64_t> queue(4);
+    for (uint64_t i = 0; i < 6; i++) {
+        uint64_t item = i;
+        queue.enqueue_nowait(std::move(item));
+    }
+    uint64_t item = 9;
+    queue.enqueue_if_have_room(std::move(item));
+    uint64_t oldest = 0;
+    queue.dequeue(oldest);
+    spdlog::info("overrun {} (expect 2), discard {} (expect 1), oldest {} (expect 2)",
+                 queue.overrun_counter(), queue.discard_counter(), oldest);
+    mpmc_blocking_queue<uint64_t> empty(4);
+    auto start = std::chrono::steady_clock::now();
+    bool got = empty.dequeue_for(item, std::chrono::milliseconds(20));
+    std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - start;
+    spdlog::info("dequeue_for on an empty queue: {} after {:.1f} ms (expect false after 20)", got, waited.count());
+}
@@ -0,0 +1,167 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <netinet/in.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Sends every file under resources/images over a loopback TCP connection,
+// once as header + mapped body with writev (the mapping kept alive, as the
+// file cache does, and mapped per request, as before the cache) and once as
+// header with MSG_MORE followed by sendfile(2).
+// usage: bench_sendfile [resource dir] [rounds]
+
+static const std::string kHeader =
+    "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nContent-type: image/jpeg\r\n"
+    "Content-length: 0000000\r\n\r\n";
+
+static void WriteAll(int sock, struct iovec *iov, int iov_cnt) {
+    while (iov_cnt > 0) {
+        ssize_t len = writev(sock, iov, iov_cnt);
+        if (len < 0) {
+            throw std::system_error(errno, std::generic_category());
+        }
+        while (iov_cnt > 0 && static_cast<size_t>(len) >= iov->iov_len) {
+            len -= iov->iov_len;
+            iov++;
+            iov_cnt--;
+        }
+        if (iov_cnt > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + len;
+            iov->iov_len -= len;
+        }
+    }
+}
+
+static void WriteMapped(int sock, const char *data, size_t size) {
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char *>(kHeader.data());
+    iov[0].iov_len = kHeader.size();
+    iov[1].iov_base = const_cast<char *>(data);
+    iov[1].iov_len = size;
+    WriteAll(sock, iov, 2);
+}
+
+static void MapAndWrite(int sock, const std::string &path, size_t size) {
+    int fd = open(path.data(), O_RDONLY);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    WriteMapped(sock, static_cast<const char *>(data), size);
+    munmap(data, size);
+}
+
+static void SendFile(int sock, int fd, size_t size) {
+    if (send(sock, kHeader.data(), kHeader.size(), MSG_MORE) < 0) {
+        throw std::system_error(errno, std::generic_category());
+    }
+    off_t offset = 0;
+    while (static_cast<size_t>(offset) < size) {
+        if (sendfile(sock, fd, &offset, size - offset) <= 0) {
+            throw std::system_error(errno, std::generic_category());
+        }
+    }
+}
+
+// a connected loopback pair, the peer is drained by a thread
+struct Loopback {
+    Loopback() {
+        int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addr_len = sizeof(addr);
+        bind(listen_fd, (struct sockaddr *)&addr, addr_len);
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len);
+        listen(listen_fd, 1);
+        sender = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(sender, (struct sockaddr *)&addr, addr_len) < 0) {
+            throw std::system_error(errno, std::generic_category());
+        }
+        int receiver = accept(listen_fd, nullptr, nullptr);
+        close(listen_fd);
+        drain = std::jthread([receiver] {
+            std::vector<char> buf(1 << 20);
+            while (read(receiver, buf.data(), buf.size()) > 0) {}
+            close(receiver);
+        });
+    }
+
+    ~Loopback() {
+        shutdown(sender, SHUT_WR);
+        close(sender);
+    }
+
+    int sender = -1;
+    std::jthread drain;
+};
+
+struct File {
+    std::string path;
+    size_t size;
+    int fd;
+    const char *data;
+};
+
+template <typename F>
+static void Bench(const char *name, const std::vector<File> &files, int rounds, F &&f) {
+    Loopback loopback;
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        for (auto &file : files) {
+            f(loopback.sender, file);
+            bytes += kHeader.size() + file.size;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    spdlog::info("{:<20} {:>8.1f} MB/s, {:>8.0f} responses/s", name,
+                 bytes / elapsed.count() / (1 << 20),
+                 rounds * files.size() / elapsed.count());
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "resources";
+    int rounds = argc > 2 ? std::stoi(argv[2]) : 2000;
+
+    std::vector<File> files;
+    for (auto &entry : std::filesystem::directory_iterator(dir + "/images")) {
+        if (!entry.is_regular_file() || entry.file_size() == 0) {
+            continue;
+        }
+        File file{entry.path().string(), entry.file_size(), -1, nullptr};
+        file.fd = open(file.path.data(), O_RDONLY);
+        file.data = static_cast<const char *>(
+            mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, file.fd, 0));
+        spdlog::info("{}: {} bytes", file.path, file.size);
+        files.push_back(file);
+    }
+    if (files.empty()) {
+        spdlog::error("no files under {}/images", dir);
+        return 1;
+    }
+
+    Bench("mmap per request", files, rounds, [](int sock, const File &file) {
+        MapAndWrite(sock, file.path, file.size);
+    });
+    Bench("cached mmap+writev", files, rounds, [](int sock, const File &file) {
+        WriteMapped(sock, file.data, file.size);
+    });
+    Bench("sendfile", files, rounds, [](int sock, const File &file) {
+        SendFile(sock, file.fd, file.size);
+    });
+
+    for (auto &file : files) {
+        munmap(const_cast<char *>(file.data), file.size);
+        close(file.fd);
+    }
+}
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <chrono>
+#include <clock.h>
+#include <heaptimer.h>
+#include <memory>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <timing_wheel.h>
+#include <vector>
+
+// HeapTimer against TimingWheel on the pattern of a worker with many idle
+// keep-alive connections: every connection gets a timer, then random
+// connections see traffic and push their timeout back, and finally all of
+// them close. Grew out of ex_heaptimer.
+//
+// The wheel is also checked against a fake clock: every timer must fire in
+// the tick it is due, never before, and shortened timeouts must be honored.
+// usage: bench_timer [connections] [extends]
+
+using namespace std::chrono_literals;
+
+template <typename F>
+static double Millis(F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void BenchHeap(int conns, int extends, const std::vector<int> &order) {
+    HeapTimer timer;
+    double add = Millis([&] {
+        for (int fd = 0; fd < conns; fd++) {
+            timer.Add(fd, 10min, [&timer, fd] { timer.Del(fd); });
+        }
+    });
+    double extend = Millis([&] {
+        for (int i = 0; i < extends; i++) {
+            timer.Extend(order[i % order.size()], 10min);
+        }
+    });
+    double del = Millis([&] {
+        for (int fd = 0; fd < conns; fd++) {
+            timer.Del(fd);
+        }
+    });
+    spdlog::info("{:<13} add {:>7.1f} ns, extend {:>7.1f} ns, cancel {:>7.1f} ns", "HeapTimer",
+                 add * 1e6 / conns, extend * 1e6 / extends, del * 1e6 / conns);
+}
+
+static void BenchWheel(int conns, int extends, const std::vector<int> &order) {
+    TimingWheel timer(100ms);
+    auto hooks = std::make_unique<TimerHook[]>(conns);
+    double add = Millis([&] {
+        auto now = TimingWheel::Clock::now();
+        for (int fd = 0; fd < conns; fd++) {
+            timer.Schedule(hooks[fd], fd, now, 10min);
+        }
+    });
+    double extend = Millis([&] {
+        for (int i = 0; i < extends; i++) {
+            int fd = order[i % order.size()];
+            // a worker refreshes its clock once per batch of epoll events
+            if (i % 64 == 0) {
+                CachedClock::Refresh();
+            }
+            timer.Schedule(hooks[fd], fd, CachedClock::Now(), 10min);
+        }
+    });
+    double del = Millis([&] {
+        for (int fd = 0; fd < conns; fd++) {
+            timer.Cancel(hooks[fd]);
+        }
+    });
+    spdlog::info("{:<13} add {:>7.1f} ns, extend {:>7.1f} ns, cancel {:>7.1f} ns", "TimingWheel",
+                 add * 1e6 / conns, extend * 1e6 / extends, del * 1e6 / conns);
+}
+
+// random schedules, extends, shortenings and cancels over simulated hours
+static bool CheckWheel(int conns) {
+    constexpr auto kTick = 100ms;
+    auto origin = TimingWheel::Clock::now();
+    TimingWheel timer(kTick, origin);
+    auto hooks = std::make_unique<TimerHook[]>(conns);
+    std::vector<int64_t> due(conns, -1);
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> pick(0, conns - 1);
+    std::uniform_int_distribution<int> action(0, 9);
+    std::uniform_int_distribution<int> timeout_ms(0, 3 * 3600 * 1000);
+    bool ok = true;
+    size_t fired = 0;
+    for (int64_t tick = 0; tick < 200000; tick++) {
+        auto now = origin + kTick * tick;
+        timer.Advance(now, [&](int fd) {
+            // due[] holds the tick the timer is due in
+            if (due[fd] != tick) {
+                ok = false;
+            }
+            due[fd] = -1;
+            fired++;
+        });
+        for (int i = 0; i < 5; i++) {
+            int fd = pick(rng);
+            if (action(rng) == 0) {
+                timer.Cancel(hooks[fd]);
+                due[fd] = -1;
+                continue;
+            }
+            // short timeouts now and then, so extends also shorten
+            auto timeout = std::chrono::milliseconds(action(rng) < 3 ? timeout_ms(rng) / 1000 : timeout_ms(rng));
+            timer.Schedule(hooks[fd], fd, now, timeout);
+            // due in the tick just processed fires in the next Advance
+            due[fd] = std::max<int64_t>((timeout + kTick - 1ms) / kTick + tick, tick + 1);
+        }
+    }
+    spdlog::info("wheel check: {} timers fired, {}", fired, ok ? "all in their tick" : "WRONG TICK");
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    int conns = argc > 1 ? std::stoi(argv[1]) : 100000;
+    int extends = argc > 2 ? std::stoi(argv[2]) : 1000000;
+    std::vector<int> order(conns);
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> pick(0, conns - 1);
+    for (auto &fd : order) {
+        fd = pick(rng);
+    }
+    spdlog::info("{} connections, {} extends", conns, extends);
+    BenchHeap(conns, extends, order);
+    BenchWheel(conns, extends, order);
+    return CheckWheel(2000) ? 0 : 1;
+}
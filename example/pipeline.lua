@@ -0,0 +1,18 @@
+-- wrk script that sends requests pipelined, depth at a time on each
+-- connection, to measure HTTP/1.1 pipelining:
+--   wrk -t12 -c400 -d30s -s example/pipeline.lua http://127.0.0.1:8888/ -- 16
+-- The optional argument is the depth (default 16). wrk counts every
+-- response, so Requests/sec is directly comparable to a run without -s.
+
+init = function(args)
+    local depth = tonumber(args[1]) or 16
+    local requests = {}
+    for i = 1, depth do
+        requests[i] = wrk.format(nil, wrk.path)
+    end
+    pipelined = table.concat(requests)
+end
+
+request = function()
+    return pipelined
+end
@@ -1,21 +1,55 @@
 #pragma once
 
 #include <bits/types/struct_iovec.h>
+#include <buffer_pool.h>
 #include <cerrno>
 #include <climits>
 #include <cstddef>
+#include <cstring>
 #include <spdlog/spdlog.h>
+#include <string>
 #include <sys/types.h>
 #include <system_error>
-#include <vector>
 #include <sys/uio.h>
+#include <utility>
+
+// Contiguous byte buffer on a block from the thread's BufferPool. No block is
+// taken until the first byte arrives, and Release() hands it back, so an idle
+// connection holds no buffer memory. Growing moves to a block of the next
+// size class and copies only the bytes still to be read.
 class Buffer {
 public:
     static const size_t initialSize = 1024;
 
     explicit Buffer(size_t initial_size = initialSize)
-        : buffer_(initial_size) {
+        : initial_size_(initial_size) {
+
+    }
 
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    Buffer(Buffer&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          capacity_(std::exchange(other.capacity_, 0)),
+          readerIndex_(std::exchange(other.readerIndex_, 0)),
+          writerIndex_(std::exchange(other.writerIndex_, 0)),
+          initial_size_(other.initial_size_) {}
+
+    Buffer& operator=(Buffer&& other) noexcept {
+        if (this != &other) {
+            Release();
+            data_ = std::exchange(other.data_, nullptr);
+            capacity_ = std::exchange(other.capacity_, 0);
+            readerIndex_ = std::exchange(other.readerIndex_, 0);
+            writerIndex_ = std::exchange(other.writerIndex_, 0);
+            initial_size_ = other.initial_size_;
+        }
+        return *this;
+    }
+
+    ~Buffer() {
+        Release();
     }
 
     size_t ReadableBytes() const {
@@ -23,15 +57,15 @@ public:
     }
 
     size_t writableBytes() const {
-        return buffer_.size() - writerIndex_;
+        return capacity_ - writerIndex_;
     }
 
     const char* Peak() {
-        return buffer_.data() + readerIndex_;
+        return data_ + readerIndex_;
     }
 
     const char* BeginWrite() {
-        return buffer_.data() + writerIndex_;
+        return data_ + writerIndex_;
     }
     size_t prependableBytes() const {
         return readerIndex_;
@@ -48,6 +82,15 @@ public:
         readerIndex_ = 0;
         writerIndex_ = 0;
     }
+    // drops the contents and gives the block back to the pool
+    void Release() {
+        if (data_) {
+            BufferPool::Local().Release(data_, capacity_);
+            data_ = nullptr;
+            capacity_ = 0;
+        }
+        RetrieveAll();
+    }
     std::string RetrieveAllToStr() {
         std::string str(Peak(), ReadableBytes());
         RetrieveAll();
@@ -61,53 +104,131 @@ public:
         Append(str.data(), str.size());
     }
 
+    // what the server writes is granted past the pool's limit
     void Append(const char* str, size_t len) {
-        if (writableBytes() < len) {
-            if (writableBytes() + prependableBytes() < len) {
-                buffer_.resize(ReadableBytes() + len);
-            } else {
-                size_t readble = ReadableBytes();
-                std::copy(buffer_.data() + readerIndex_, buffer_.data() + writerIndex_, buffer_.data());
-                readerIndex_ = 0;
-                writerIndex_ = readble;
-            }
-        }
-        std::copy(str, str + len, buffer_.data() + writerIndex_);
-        writerIndex_ += len;
+        Append(str, len, true);
+    }
+
+    // Append() for bytes from a client, which fails instead of growing the
+    // buffer past the pool's limit
+    bool TryAppend(const char* str, size_t len) {
+        return Append(str, len, false);
     }
 
+    // Reads from fd until it would block, is at EOF or a read comes back
+    // short, and returns what the last read returned. Once less than
+    // initial_size bytes fit behind the readable ones, the rest is read
+    // straight into the block the buffer grows into, at the offset it ends
+    // up at, so it is never copied; with more room the read goes into the
+    // buffer alone, and a full one is followed by another, so that no block
+    // is taken from the pool and handed back unused on every read. Fails
+    // with ENOBUFS when the pool's limit leaves the buffer no room.
     ssize_t ReadFd(int fd, int& read_errno) {
-        char extrabuff[65536];
-        struct iovec iov[2];
         ssize_t len = 0;
         while (true) {
+            if (readerIndex_ > 0 && readerIndex_ >= capacity_ / 2) {
+                Compact();
+            }
             size_t writable = writableBytes();
-            iov[0].iov_base = buffer_.data() + writerIndex_;
+            // the bytes kept on growing: the readable ones and the tail
+            size_t kept = capacity_ - readerIndex_;
+            size_t next_capacity = 0;
+            char* next = nullptr;
+            if (writable < initial_size_) {
+                next = BufferPool::Local().Acquire(
+                    std::max(initial_size_, capacity_ * 2), next_capacity, false);
+            }
+            if (!next && writable == 0) {
+                read_errno = ENOBUFS;
+                return -1;
+            }
+            struct iovec iov[2];
+            iov[0].iov_base = data_ + writerIndex_;
             iov[0].iov_len = writable;
-            iov[1].iov_base = extrabuff;
-            iov[1].iov_len = sizeof(extrabuff);
+            iov[1].iov_base = next ? next + kept : nullptr;
+            iov[1].iov_len = next ? next_capacity - kept : 0;
 
-            ssize_t len = readv(fd, iov, 2);
+            len = readv(fd, iov, 2);
+            // a short read emptied the socket; bytes arriving later raise a
+            // new event, so the read that would only see EAGAIN is saved
+            bool drained = len > 0 && static_cast<size_t>(len) < iov[0].iov_len + iov[1].iov_len;
 
-            if (len == 0) {
-                break;
+            if (len > 0 && static_cast<size_t>(len) > writable) {
+                if (data_) {
+                    std::memcpy(next, data_ + readerIndex_, kept);
+                    BufferPool::Local().Release(data_, capacity_);
+                }
+                data_ = next;
+                capacity_ = next_capacity;
+                writerIndex_ = kept + (len - writable);
+                readerIndex_ = 0;
+            } else {
+                if (next) {
+                    BufferPool::Local().Release(next, next_capacity);
+                }
+                if (len == 0) {
+                    break;
+                }
+                if (len < 0) {
+                    read_errno = errno;
+                    break;
+                }
+                writerIndex_ += len;
             }
-            if (len < 0) {
-                read_errno = errno;
+            if (drained) {
                 break;
             }
+        }
+        return len;
+    }
 
-            if (static_cast<size_t>(len) <= writable) {
-                writerIndex_ += len;
+private:
+    bool Append(const char* str, size_t len, bool force) {
+        if (writableBytes() < len) {
+            if (availableBytes() < len) {
+                if (!Grow(ReadableBytes() + len, force)) {
+                    return false;
+                }
             } else {
-                writerIndex_ = buffer_.size();
-                Append(extrabuff, len - writable);
+                Compact();
             }
         }
-        return len;
+        std::copy(str, str + len, data_ + writerIndex_);
+        writerIndex_ += len;
+        return true;
+    }
+
+    // moves the readable bytes to the front of the block
+    void Compact() {
+        size_t readable = ReadableBytes();
+        std::memmove(data_, data_ + readerIndex_, readable);
+        readerIndex_ = 0;
+        writerIndex_ = readable;
+    }
+
+    // moves the readable bytes to a block of at least size bytes, false if
+    // the pool refuses one
+    bool Grow(size_t size, bool force) {
+        size_t capacity = 0;
+        char* block = BufferPool::Local().Acquire(std::max(size, initial_size_), capacity, force);
+        if (!block) {
+            return false;
+        }
+        size_t readable = ReadableBytes();
+        if (data_) {
+            std::memcpy(block, data_ + readerIndex_, readable);
+            BufferPool::Local().Release(data_, capacity_);
+        }
+        data_ = block;
+        capacity_ = capacity;
+        readerIndex_ = 0;
+        writerIndex_ = readable;
+        return true;
     }
-// private:
-    std::vector<char> buffer_;
+
+    char* data_ = nullptr;
+    size_t capacity_ = 0;
     size_t readerIndex_{};
     size_t writerIndex_{};
-};
\ No newline at end of file
+    size_t initial_size_;
+};
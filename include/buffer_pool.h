@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// Memory for Buffers, in power-of-two size classes from 1 KiB to 1 MiB. Each
+// thread has a pool of its own, so taking and returning a block is a push or
+// pop on a vector without a lock; a block may be returned on any thread.
+// Blocks larger than the largest class come from operator new and go back to
+// it.
+//
+// All pools share one limit on the bytes held by buffers. Past it, requests
+// that may be refused (reads from clients) fail, so that a flood of slow or
+// oversized requests turns into 503s instead of growing the process; what
+// the server writes itself is always granted. Pools charge the shared count
+// in chunks and keep the credit, so most blocks change hands without
+// touching it; the limit is exact to a few chunks per thread.
+class BufferPool {
+public:
+    static constexpr int kMinClassBits = 10;
+    static constexpr int kMaxClassBits = 20;
+    static constexpr int kClasses = kMaxClassBits - kMinClassBits + 1;
+    // free bytes a pool keeps per size class, the rest goes back to the heap
+    static constexpr size_t kMaxCachedPerClass = 256 * 1024;
+    // granularity in which a pool charges the shared count
+    static constexpr size_t kCreditChunk = 64 * 1024;
+
+    BufferPool() = default;
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    ~BufferPool() {
+        in_use_.fetch_sub(credit_, std::memory_order_relaxed);
+        for (auto &blocks : free_) {
+            for (char *block : blocks) {
+                ::operator delete(block);
+            }
+        }
+    }
+
+    // the calling thread's pool
+    static BufferPool &Local() {
+        thread_local BufferPool pool;
+        return pool;
+    }
+
+    // size rounded up to its class, or left alone above the largest class
+    static size_t ClassSize(size_t size) {
+        if (size > (size_t{1} << kMaxClassBits)) {
+            return size;
+        }
+        return std::max(std::bit_ceil(size), size_t{1} << kMinClassBits);
+    }
+
+    // A block of ClassSize(size) bytes, which is stored in capacity. Returns
+    // nullptr if the block would take the buffers past the limit, unless
+    // force is set.
+    char *Acquire(size_t size, size_t &capacity, bool force) {
+        capacity = ClassSize(size);
+        if (!Charge(capacity, force)) {
+            rejections_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        if (int cls = ClassOf(capacity); cls >= 0 && !free_[cls].empty()) {
+            char *block = free_[cls].back();
+            free_[cls].pop_back();
+            return block;
+        }
+        return static_cast<char *>(::operator new(capacity));
+    }
+
+    void Release(char *block, size_t capacity) {
+        credit_ += capacity;
+        if (credit_ > 2 * kCreditChunk) {
+            in_use_.fetch_sub(credit_ - kCreditChunk, std::memory_order_relaxed);
+            credit_ = kCreditChunk;
+        }
+        int cls = ClassOf(capacity);
+        if (cls >= 0 && (free_[cls].size() + 1) * capacity <= kMaxCachedPerClass) {
+            free_[cls].push_back(block);
+        } else {
+            ::operator delete(block);
+        }
+    }
+
+    static void SetLimit(size_t bytes) {
+        limit_.store(bytes, std::memory_order_relaxed);
+    }
+
+    // bytes held by buffers in all threads, plus the pools' credit
+    static size_t InUse() {
+        return in_use_.load(std::memory_order_relaxed);
+    }
+
+    // blocks refused because of the limit
+    static size_t Rejections() {
+        return rejections_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // takes bytes from the credit, topping it up from the shared count
+    bool Charge(size_t bytes, bool force) {
+        if (credit_ < bytes) {
+            size_t limit = limit_.load(std::memory_order_relaxed);
+            size_t want = bytes - credit_ + kCreditChunk;
+            if (in_use_.fetch_add(want, std::memory_order_relaxed) + want > limit && !force) {
+                in_use_.fetch_sub(want, std::memory_order_relaxed);
+                // without the spare chunk it may still fit
+                want = bytes - credit_;
+                if (in_use_.fetch_add(want, std::memory_order_relaxed) + want > limit) {
+                    in_use_.fetch_sub(want, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            credit_ += want;
+        }
+        credit_ -= bytes;
+        return true;
+    }
+
+    // the class of a block capacity, -1 for blocks outside the classes
+    static int ClassOf(size_t capacity) {
+        if (capacity > (size_t{1} << kMaxClassBits)) {
+            return -1;
+        }
+        return std::countr_zero(capacity) - kMinClassBits;
+    }
+
+    std::array<std::vector<char *>, kClasses> free_;
+    // bytes charged to the shared count but not held by any buffer
+    size_t credit_ = 0;
+    inline static std::atomic<size_t> in_use_{0};
+    inline static std::atomic<size_t> limit_{SIZE_MAX};
+    inline static std::atomic<size_t> rejections_{0};
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <ctime>
+
+// CLOCK_MONOTONIC_COARSE as a std::chrono clock: never jumps with the wall
+// clock, and is read from the vDSO without a syscall at the price of a
+// resolution of one jiffy (1-4ms), plenty for timeouts and access logs.
+struct CoarseClock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<CoarseClock>;
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return time_point(std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec));
+    }
+};
+
+// Per-thread CoarseClock reading that an event loop refreshes once per
+// iteration, right after epoll_wait returns, so that everything handled in
+// that iteration (timers, access log, idle tracking) agrees on one "now"
+// without reading the clock again. Threads that never call Refresh() get a
+// fresh reading from Now().
+class CachedClock {
+public:
+    using time_point = CoarseClock::time_point;
+
+    static time_point Now() noexcept {
+        return now_ == time_point{} ? CoarseClock::now() : now_;
+    }
+
+    static time_point Refresh() noexcept {
+        now_ = CoarseClock::now();
+        return now_;
+    }
+
+private:
+    // constant-initialized, so reading it needs no TLS init guard
+    inline static thread_local time_point now_{};
+};
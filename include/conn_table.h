@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <httpconn.h>
+#include <memory>
+#include <vector>
+
+// A worker's connections, indexed by fd. The slots form a flat vector, so
+// finding a connection is an index and not a hash lookup, and nothing is
+// inserted by looking. Connections live on the heap at fixed addresses, which
+// epoll events and timer hooks point at. A closed connection goes to a free
+// list and is handed out again for the next fd, and its buffers go to the
+// BufferPool, so a worker at steady load does not allocate per connection.
+class ConnTable {
+public:
+    // closed connections kept for reuse, beyond this they are freed
+    static constexpr size_t kMaxFree = 1024;
+
+    ConnTable() = default;
+    ConnTable(const ConnTable &) = delete;
+    ConnTable &operator=(const ConnTable &) = delete;
+    ConnTable(ConnTable &&) = default;
+    ConnTable &operator=(ConnTable &&) = default;
+
+    // a connection object for fd, which must not have one
+    HttpConn &Acquire(int fd) {
+        if (static_cast<size_t>(fd) >= slots_.size()) {
+            slots_.resize(fd + 1);
+        }
+        auto &slot = slots_[fd];
+        if (free_.empty()) {
+            slot = std::make_unique<HttpConn>();
+        } else {
+            slot = std::move(free_.back());
+            free_.pop_back();
+        }
+        size_++;
+        return *slot;
+    }
+
+    // the connection on fd, nullptr if there is none
+    HttpConn *Get(int fd) const {
+        return static_cast<size_t>(fd) < slots_.size() ? slots_[fd].get() : nullptr;
+    }
+
+    // closes the connection on fd and keeps the object for reuse, see
+    // HttpConn::Reset() for close_socket
+    void Release(int fd, bool close_socket = true) {
+        auto &slot = slots_[fd];
+        slot->Reset(close_socket);
+        if (free_.size() < kMaxFree) {
+            free_.push_back(std::move(slot));
+        } else {
+            slot.reset();
+        }
+        size_--;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+private:
+    std::vector<std::unique_ptr<HttpConn>> slots_;
+    std::vector<std::unique_ptr<HttpConn>> free_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <http_headers.h>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+#ifdef MINISERVER_HAS_BROTLI
+#include <brotli/encode.h>
+#endif
+
+// Content codings the server can send, in order of preference.
+enum class CONTENT_ENCODING : uint8_t {
+    BR,
+    GZIP,
+    IDENTITY,
+};
+
+inline constexpr size_t kContentEncodingCount = static_cast<size_t>(CONTENT_ENCODING::IDENTITY);
+
+inline constexpr std::string_view kContentEncodingNames[kContentEncodingCount] = {
+    "br",
+    "gzip",
+};
+
+// file name suffix of a precompressed sibling
+inline constexpr std::string_view kContentEncodingSuffixes[kContentEncodingCount] = {
+    ".br",
+    ".gz",
+};
+
+constexpr unsigned EncodingBit(CONTENT_ENCODING encoding) {
+    return 1u << static_cast<unsigned>(encoding);
+}
+
+// true for a "q=0", "q=0.0", ... parameter, other parameters are ignored
+constexpr bool QualityIsZero(std::string_view params) {
+    while (!params.empty()) {
+        auto semi = params.find(';');
+        auto param = params.substr(0, semi);
+        params.remove_prefix(semi == std::string_view::npos ? params.size() : semi + 1);
+        while (!param.empty() && (param.front() == ' ' || param.front() == '\t')) { param.remove_prefix(1); }
+        while (!param.empty() && (param.back() == ' ' || param.back() == '\t')) { param.remove_suffix(1); }
+        if (param.size() < 3 || (param[0] | 0x20) != 'q' || param[1] != '=') {
+            continue;
+        }
+        auto q = param.substr(2);
+        if (q[0] != '0' || (q.size() > 1 && q[1] != '.')) {
+            return false;
+        }
+        return q.size() <= 2 || q.find_first_not_of('0', 2) == std::string_view::npos;
+    }
+    return false;
+}
+
+// Accept-Encoding (RFC 9110 12.5.3): the codings the client takes, a bit per
+// CONTENT_ENCODING. A coding with q=0 is ruled out and "*" stands for every
+// coding the header does not name.
+constexpr unsigned AcceptedEncodings(std::string_view value) {
+    unsigned named = 0;
+    unsigned accepted = 0;
+    bool star = false;
+    while (!value.empty()) {
+        auto comma = value.find(',');
+        auto item = value.substr(0, comma);
+        value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+        auto semi = item.find(';');
+        auto coding = item.substr(0, semi);
+        auto params = semi == std::string_view::npos ? std::string_view{} : item.substr(semi + 1);
+        while (!coding.empty() && (coding.front() == ' ' || coding.front() == '\t')) { coding.remove_prefix(1); }
+        while (!coding.empty() && (coding.back() == ' ' || coding.back() == '\t')) { coding.remove_suffix(1); }
+        bool zero = QualityIsZero(params);
+        if (coding == "*") {
+            star = !zero;
+            continue;
+        }
+        if (EqualsIgnoreCase(coding, "x-gzip")) {
+            coding = "gzip";
+        }
+        for (size_t i = 0; i < kContentEncodingCount; i++) {
+            if (EqualsIgnoreCase(coding, kContentEncodingNames[i])) {
+                named |= 1u << i;
+                if (!zero) {
+                    accepted |= 1u << i;
+                }
+            }
+        }
+    }
+    if (star) {
+        accepted |= ((1u << kContentEncodingCount) - 1) & ~named;
+    }
+    return accepted;
+}
+
+static_assert(AcceptedEncodings("gzip, deflate, br") == (EncodingBit(CONTENT_ENCODING::BR) | EncodingBit(CONTENT_ENCODING::GZIP)));
+static_assert(AcceptedEncodings("br;q=0, *") == EncodingBit(CONTENT_ENCODING::GZIP));
+static_assert(AcceptedEncodings("gzip;q=0.000") == 0);
+static_assert(AcceptedEncodings("identity") == 0);
+
+// text and the structured text formats shrink well, images and fonts in
+// woff/woff2 are compressed already
+inline bool IsCompressible(std::string_view content_type) {
+    return content_type.substr(0, 5) == "text/"
+           || content_type == "application/javascript"
+           || content_type == "application/json"
+           || content_type == "application/xml"
+           || content_type == "application/xhtml+xml"
+           || content_type == "image/svg+xml";
+}
+
+// Compresses size bytes at data into out. The result is spent on many
+// responses, so the slowest settings are worth it.
+inline bool Compress(CONTENT_ENCODING encoding, const char *data, size_t size, std::string &out) {
+    if (encoding == CONTENT_ENCODING::GZIP) {
+        z_stream zs{};
+        // 15 window bits, + 16 for a gzip wrapper instead of zlib's
+        if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        out.resize(deflateBound(&zs, size));
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zs.avail_in = static_cast<uInt>(size);
+        zs.next_out = reinterpret_cast<Bytef *>(out.data());
+        zs.avail_out = static_cast<uInt>(out.size());
+        int ret = deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return ret == Z_STREAM_END;
+    }
+#ifdef MINISERVER_HAS_BROTLI
+    if (encoding == CONTENT_ENCODING::BR) {
+        size_t len = BrotliEncoderMaxCompressedSize(size);
+        out.resize(len);
+        // quality 11 is several times slower than 9 for a few percent
+        int ok = BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size,
+                                       reinterpret_cast<const uint8_t *>(data), &len,
+                                       reinterpret_cast<uint8_t *>(out.data()));
+        out.resize(ok ? len : 0);
+        return ok;
+    }
+#endif
+    return false;
+}
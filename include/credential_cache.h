@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <clock.h>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// The user table's answer for a username: the stored password, or that there
+// is no such user, so that repeated logins, including failed ones, do not go
+// to the database. Registrations write through. An entry is trusted for ttl,
+// which bounds how long a change made to the table by someone else goes
+// unnoticed.
+//
+// Like FileCache, the entries are spread over a fixed number of shards, each
+// with its own lock, LRU list and share of max_entries.
+class CredentialCache {
+public:
+    static constexpr size_t kShards = 16;
+
+    static CredentialCache &GetInstance() {
+        static CredentialCache credential_cache;
+        return credential_cache;
+    }
+
+    CredentialCache(const CredentialCache &) = delete;
+    CredentialCache &operator=(const CredentialCache &) = delete;
+
+    // max_entries 0 disables the cache
+    void Init(size_t max_entries, std::chrono::seconds ttl) {
+        max_shard_entries_ = (max_entries + kShards - 1) / kShards;
+        ttl_ = ttl;
+    }
+
+    // Whether name has a live entry, which is stored in password: nullopt
+    // if there is no such user.
+    bool Lookup(const std::string &name, std::optional<std::string> &password) {
+        auto &shard = ShardOf(name);
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(name);
+            if (it != shard.index.end()) {
+                if (CachedClock::Now() < it->second->expires) {
+                    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                    password = it->second->password;
+                    hits_.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                shard.lru.erase(it->second);
+                shard.index.erase(it);
+            }
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // what the user table says about name, nullopt for no such user
+    void Put(const std::string &name, std::optional<std::string> password) {
+        if (max_shard_entries_ == 0) {
+            return;
+        }
+        auto &shard = ShardOf(name);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(name);
+        if (it != shard.index.end()) {
+            shard.lru.erase(it->second);
+            shard.index.erase(it);
+        }
+        shard.lru.push_front({name, std::move(password), CachedClock::Now() + ttl_});
+        shard.index.emplace(name, shard.lru.begin());
+        if (shard.lru.size() > max_shard_entries_) {
+            shard.index.erase(shard.lru.back().name);
+            shard.lru.pop_back();
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // forgets name, whose entry may be wrong
+    void Erase(const std::string &name) {
+        auto &shard = ShardOf(name);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(name);
+        if (it != shard.index.end()) {
+            shard.lru.erase(it->second);
+            shard.index.erase(it);
+        }
+    }
+
+    // every hit is a query the database did not have to answer
+    size_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+
+    size_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    size_t Evictions() const { return evictions_.load(std::memory_order_relaxed); }
+
+    double HitRatio() const {
+        size_t hits = Hits();
+        size_t lookups = hits + Misses();
+        return lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups;
+    }
+
+    size_t Entries() const {
+        size_t entries = 0;
+        for (auto &shard : shards_) {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            entries += shard.lru.size();
+        }
+        return entries;
+    }
+
+private:
+    CredentialCache() = default;
+
+    struct Entry {
+        std::string name;
+        std::optional<std::string> password;
+        CachedClock::time_point expires;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    };
+
+    Shard &ShardOf(const std::string &name) {
+        return shards_[std::hash<std::string>{}(name) % kShards];
+    }
+
+    std::array<Shard, kShards> shards_;
+    size_t max_shard_entries_ = 0;
+    std::chrono::seconds ttl_{60};
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+    std::atomic<size_t> evictions_{0};
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <logger.h>
+#include <memory>
+#include <mpmc_blocking_q.h>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Threads that run the database work of requests, so that a slow query or a
+// wait for a pooled connection stalls only the request behind it and never a
+// worker's event loop. A job reports back to its worker by itself, see
+// ServerHandler::SubmitUserQuery(). A connection has at most one job queued
+// or running, so a queue as large as the connection limit never fills.
+class DbExecutor {
+public:
+    DbExecutor() = default;
+    DbExecutor(const DbExecutor &) = delete;
+    DbExecutor &operator=(const DbExecutor &) = delete;
+
+    static DbExecutor &GetInstance() {
+        static DbExecutor db_executor;
+        return db_executor;
+    }
+
+    // More threads than pooled connections would only wait for one.
+    void Init(int threads, size_t max_jobs) {
+        jobs_ = std::make_unique<mpmc_blocking_queue<std::function<void()>>>(max_jobs);
+        for (int i = 0; i < threads; i++) {
+            threads_.emplace_back([this] { Run(); });
+        }
+    }
+
+    ~DbExecutor() {
+        // an empty job stops a thread
+        for (size_t i = 0; i < threads_.size(); i++) {
+            jobs_->enqueue({});
+        }
+        threads_.clear();
+    }
+
+    void Submit(std::function<void()> job) {
+        jobs_->enqueue(std::move(job));
+    }
+
+private:
+    void Run() {
+        while (true) {
+            std::function<void()> job;
+            jobs_->dequeue(job);
+            if (!job) {
+                return;
+            }
+            try {
+                job();
+            } catch (const std::exception &e) {
+                SPDLOG_LOGGER_ERROR(logger, "db job failed: {}", e.what());
+            }
+        }
+    }
+
+    std::unique_ptr<mpmc_blocking_queue<std::function<void()>>> jobs_;
+    std::vector<std::jthread> threads_;
+};
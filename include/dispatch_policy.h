@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+
+enum class DISPATCH_POLICY {
+    ROUND_ROBIN,           // rotate over the workers
+    LEAST_CONNECTIONS,     // the worker with the fewest live connections
+    POWER_OF_TWO_CHOICES,  // the less loaded of two random workers
+    QUEUE_DEPTH_WEIGHTED,  // connections plus weighted handoff and event backlog
+};
+
+// Load a worker publishes for the dispatcher. Each counter is written by one
+// thread and read by the acceptor without locks, so a value may be a moment
+// old, which is all a dispatch decision needs. Padded to a cache line so
+// workers do not invalidate each other's counters.
+struct alignas(64) WorkerLoad {
+    // live connections of the worker, user.size()
+    std::atomic<uint32_t> connections{0};
+    // connections handed over but not yet picked up, kept by the acceptor and
+    // the worker
+    std::atomic<uint32_t> pending{0};
+    // ready events of the worker's last epoll_wait
+    std::atomic<uint32_t> events{0};
+};
+
+// Picks the worker for each new connection according to a DISPATCH_POLICY.
+// Only the acceptor thread calls Select().
+class Dispatcher {
+public:
+    // a queued connection or ready event stands for this many idle connections
+    static constexpr uint32_t kQueueWeight = 4;
+
+    explicit Dispatcher(DISPATCH_POLICY policy = DISPATCH_POLICY::ROUND_ROBIN)
+        : policy_(policy) {}
+
+    size_t Select(std::span<WorkerLoad *const> loads) {
+        size_t n = loads.size();
+        // rotating the starting point spreads ties instead of always
+        // favouring the first worker
+        next_ = (next_ + 1) % n;
+        switch (policy_) {
+        case DISPATCH_POLICY::ROUND_ROBIN:
+            return next_;
+        case DISPATCH_POLICY::LEAST_CONNECTIONS:
+            return Least(loads, [](const WorkerLoad &load) {
+                return Connections(load);
+            });
+        case DISPATCH_POLICY::POWER_OF_TWO_CHOICES: {
+            if (n == 1) {
+                return 0;
+            }
+            size_t a = Random() % n;
+            size_t b = Random() % (n - 1);
+            b += b >= a;
+            return Connections(*loads[b]) < Connections(*loads[a]) ? b : a;
+        }
+        case DISPATCH_POLICY::QUEUE_DEPTH_WEIGHTED:
+            return Least(loads, [](const WorkerLoad &load) {
+                return load.connections.load(std::memory_order_relaxed)
+                       + kQueueWeight * (load.pending.load(std::memory_order_relaxed)
+                                         + load.events.load(std::memory_order_relaxed));
+            });
+        }
+        return next_;
+    }
+
+    DISPATCH_POLICY Policy() const {
+        return policy_;
+    }
+
+private:
+    // connections handed over count as soon as they are queued, otherwise a
+    // burst would all go to the same worker
+    static uint32_t Connections(const WorkerLoad &load) {
+        return load.connections.load(std::memory_order_relaxed)
+               + load.pending.load(std::memory_order_relaxed);
+    }
+
+    template <typename Score>
+    size_t Least(std::span<WorkerLoad *const> loads, Score &&score) const {
+        size_t best = next_;
+        uint64_t best_score = std::numeric_limits<uint64_t>::max();
+        for (size_t i = 0; i < loads.size(); i++) {
+            size_t idx = (next_ + i) % loads.size();
+            uint64_t s = score(*loads[idx]);
+            if (s < best_score) {
+                best = idx;
+                best_score = s;
+            }
+        }
+        return best;
+    }
+
+    // xorshift64, only the acceptor draws from it
+    uint64_t Random() {
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 7;
+        rng_ ^= rng_ << 17;
+        return rng_;
+    }
+
+    DISPATCH_POLICY policy_;
+    size_t next_ = 0;
+    uint64_t rng_ = 0x9e3779b97f4a7c15ull;
+};
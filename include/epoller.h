@@ -48,6 +48,27 @@ public:
         }
     }
 
+    // Registers fd with ptr as its event data in place of the fd, so the
+    // handler gets at its state without a lookup. Events of fds registered
+    // this way are read back with GetEventPtr().
+    void AddFd(int fd, uint32_t events, void *ptr) const {
+        epoll_event ev = {};
+        ev.data.ptr = ptr;
+        ev.events = events;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            throw std::system_error(errno, std::generic_category());
+        }
+    }
+
+    void ModFd(int fd, uint32_t events, void *ptr) const {
+        epoll_event ev = {};
+        ev.data.ptr = ptr;
+        ev.events = events;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) < 0) {
+            throw std::system_error(errno, std::generic_category());
+        }
+    }
+
     void DelFd(int fd) const {
         epoll_event ev = {};
         if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, &ev) < 0) {
@@ -67,6 +88,10 @@ public:
         return events_[i].data.fd;
     }
 
+    void *GetEventPtr(size_t i) const {
+        return events_[i].data.ptr;
+    }
+
     uint32_t GetEvents(size_t i) const {
         return events_[i].events;
     }
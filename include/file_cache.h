@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <clock.h>
+#include <content_encoding.h>
+#include <cstddef>
+#include <fcntl.h>
+#include <functional>
+#include <http_conditional.h>
+#include <http_constants.h>
+#include <list>
+#include <logger.h>
+#include <memory>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// A static file mapped into memory once and shared by every response that
+// serves it. Responses hold a shared_ptr, so an entry that is evicted or
+// replaced stays mapped until the last of them has been written. The heads of
+// the 200 and 304 responses are serialized once per entry, in a keep-alive and
+// a close variant, and sent straight from the entry. An entry may also hold a
+// content-coded variant of a file, see VariantCache.
+struct CachedFile {
+    CachedFile() = default;
+    CachedFile(const CachedFile &) = delete;
+    CachedFile &operator=(const CachedFile &) = delete;
+
+    ~CachedFile() {
+        if (data && data != body.data()) {
+            munmap(data, size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // Loads path, nullptr if it is not a regular file or cannot be opened.
+    // Files of at least sendfile_threshold bytes are not mapped; the entry
+    // keeps the file open and the body is sent with sendfile(2).
+    static std::shared_ptr<CachedFile> Load(const std::string &path, size_t sendfile_threshold) {
+        auto file = std::make_shared<CachedFile>();
+        file->path = path;
+        if (stat(path.data(), &file->st) < 0 || !S_ISREG(file->st.st_mode)) {
+            return nullptr;
+        }
+        file->size = file->st.st_size;
+        if (file->size > 0) {
+            int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return nullptr;
+            }
+            if (file->size >= sendfile_threshold) {
+                file->fd = fd;
+            } else {
+                void *ret = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (ret == MAP_FAILED) {
+                    return nullptr;
+                }
+                file->data = static_cast<char *>(ret);
+            }
+        }
+        file->content_type = ContentTypeOf(path);
+        file->etag = MakeEtag(file->st.st_mtime, file->size);
+        file->last_modified = FormatHttpDate(file->st.st_mtime);
+        file->Serialize();
+        return file;
+    }
+
+    // Turns this entry, whose body is already in place, into the encoding
+    // variant of identity: same type and dates, its own ETag.
+    void BecomeVariantOf(const CachedFile &identity, CONTENT_ENCODING coding) {
+        st = identity.st;
+        encoding = coding;
+        content_type = identity.content_type;
+        etag = identity.etag;
+        etag.insert(etag.size() - 1, "-" + std::string(kContentEncodingNames[static_cast<size_t>(coding)]));
+        last_modified = identity.last_modified;
+        Serialize();
+    }
+
+    // fills in the header lines and response heads from the fields above
+    void Serialize() {
+        content_type_header = "Content-type: " + content_type + "\r\n";
+        content_length_header = "Content-length: " + std::to_string(size) + "\r\n\r\n";
+        validator_headers = "ETag: " + etag + "\r\nLast-Modified: " + last_modified + "\r\n";
+        encoding_header.clear();
+        if (encoding != CONTENT_ENCODING::IDENTITY) {
+            encoding_header = "Content-Encoding: "
+                              + std::string(kContentEncodingNames[static_cast<size_t>(encoding)]) + "\r\n";
+        }
+        // every response for a negotiable type depends on Accept-Encoding
+        vary_header = IsCompressible(content_type) ? "Vary: Accept-Encoding\r\n" : "";
+        header_keep_alive = SerializeHeader(true);
+        header_close = SerializeHeader(false);
+        not_modified_keep_alive = SerializeNotModified(true);
+        not_modified_close = SerializeNotModified(false);
+    }
+
+    // the complete head of a 200 response for this file
+    std::string SerializeHeader(bool keep_alive) const {
+        std::string header = "HTTP/1.1 200 OK\r\n";
+        header += keep_alive ? kKeepAliveHeader : kCloseHeader;
+        header += "Accept-Ranges: bytes\r\n";
+        header += validator_headers;
+        header += vary_header;
+        header += encoding_header;
+        header += content_type_header;
+        header += content_length_header;
+        return header;
+    }
+
+    // the complete 304 response for this file
+    std::string SerializeNotModified(bool keep_alive) const {
+        std::string header = "HTTP/1.1 304 Not Modified\r\n";
+        header += keep_alive ? kKeepAliveHeader : kCloseHeader;
+        header += validator_headers;
+        header += vary_header;
+        header += "\r\n";
+        return header;
+    }
+
+    const std::string &Header(bool keep_alive) const {
+        return keep_alive ? header_keep_alive : header_close;
+    }
+
+    const std::string &NotModifiedHeader(bool keep_alive) const {
+        return keep_alive ? not_modified_keep_alive : not_modified_close;
+    }
+
+    static std::string ContentTypeOf(const std::string &path) {
+        auto slash = path.find_last_of('/');
+        auto idx = path.find_last_of('.');
+        if (idx == std::string::npos || (slash != std::string::npos && idx < slash)) {
+            return "text/plain";
+        }
+        try {
+            return GetContentTypeByExtension(std::string_view(path).substr(idx));
+        } catch (const std::invalid_argument &) {
+            return "application/octet-stream";
+        }
+    }
+
+    // memory the entry keeps resident, charged against the cache budget
+    size_t Cost() const {
+        return data ? size : kFdEntryCost;
+    }
+
+    bool SameVersion(const struct stat &other) const {
+        return st.st_mtim.tv_sec == other.st_mtim.tv_sec
+               && st.st_mtim.tv_nsec == other.st_mtim.tv_nsec
+               && st.st_size == other.st_size && st.st_ino == other.st_ino;
+    }
+
+    // a sendfile entry only pins kernel state, charge it a page; the open
+    // descriptors are limited on their own, see FileCache
+    static constexpr size_t kFdEntryCost = 4096;
+
+    std::string path;
+    struct stat st{};
+    // the body is either mapped at data, held in body (data points into it)
+    // or sent from fd
+    char *data = nullptr;
+    int fd = -1;
+    size_t size = 0;
+    std::string body;
+    CONTENT_ENCODING encoding = CONTENT_ENCODING::IDENTITY;
+    std::string content_type;
+    std::string content_type_header;
+    std::string content_length_header;
+    std::string etag;
+    std::string last_modified;
+    // ETag and Last-Modified header lines
+    std::string validator_headers;
+    // Content-Encoding and Vary header lines, empty when they do not apply
+    std::string encoding_header;
+    std::string vary_header;
+    // pre-serialized 200 and 304 response heads, immutable once loaded
+    std::string header_keep_alive;
+    std::string header_close;
+    std::string not_modified_keep_alive;
+    std::string not_modified_close;
+    // when the file was last compared against the disk, steady clock ticks
+    mutable std::atomic<int64_t> checked_at{0};
+};
+
+// Process-wide cache of static files keyed by path, shared by all workers.
+//
+// Lookups are spread over a fixed number of shards, each with its own lock and
+// LRU list, so workers asking for different files rarely meet. An entry is
+// compared with the file on disk (mtime, size, inode) at most once per
+// revalidate interval and reloaded when it changed. When a shard goes over its
+// part of the memory budget, or of the files it may keep open for sendfile(2),
+// the least recently used entries are dropped.
+class FileCache {
+public:
+    static constexpr size_t kShards = 16;
+
+    static FileCache &GetInstance() {
+        static FileCache file_cache;
+        return file_cache;
+    }
+
+    FileCache(const FileCache &) = delete;
+    FileCache &operator=(const FileCache &) = delete;
+
+    // max_fds 0 keeps at most a sixteenth of RLIMIT_NOFILE open, leaving
+    // the rest to connections
+    void Init(
+        size_t max_bytes,
+        std::chrono::milliseconds revalidate_interval,
+        size_t sendfile_threshold,
+        size_t max_fds = 0) {
+        max_shard_bytes_ = max_bytes / kShards;
+        revalidate_interval_ = revalidate_interval;
+        sendfile_threshold_ = sendfile_threshold;
+        if (max_fds == 0) {
+            struct rlimit limit{};
+            getrlimit(RLIMIT_NOFILE, &limit);
+            max_fds = limit.rlim_cur == RLIM_INFINITY ? 65536 : limit.rlim_cur / 16;
+        }
+        max_shard_fds_ = std::max<size_t>(max_fds / kShards, 1);
+    }
+
+    // descriptors the cache may keep open
+    size_t MaxFds() const {
+        return max_shard_fds_ * kShards;
+    }
+
+    // the cached file at path, nullptr if it cannot be served
+    std::shared_ptr<const CachedFile> Get(const std::string &path) {
+        auto &shard = shards_[std::hash<std::string>{}(path) % kShards];
+        auto now = CachedClock::Now().time_since_epoch().count();
+        std::shared_ptr<const CachedFile> file;
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(path);
+            if (it != shard.index.end()) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                file = *it->second;
+            }
+        }
+        if (file) {
+            int64_t checked = file->checked_at.load(std::memory_order_relaxed);
+            if (now - checked < revalidate_ticks()) {
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return file;
+            }
+            struct stat st{};
+            if (stat(path.data(), &st) == 0 && file->SameVersion(st)) {
+                file->checked_at.store(now, std::memory_order_relaxed);
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return file;
+            }
+            SPDLOG_LOGGER_DEBUG(logger, "file cache: {} changed on disk", path);
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        auto loaded = CachedFile::Load(path, sendfile_threshold_);
+        if (!loaded) {
+            if (file) {
+                Erase(shard, path);
+            }
+            return nullptr;
+        }
+        loaded->checked_at.store(now, std::memory_order_relaxed);
+        if (loaded->Cost() <= max_shard_bytes_) {
+            Insert(shard, loaded);
+        }
+        return loaded;
+    }
+
+    size_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+
+    size_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    size_t Evictions() const { return evictions_.load(std::memory_order_relaxed); }
+
+    size_t Bytes() const {
+        size_t bytes = 0;
+        for (auto &shard : shards_) {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            bytes += shard.bytes;
+        }
+        return bytes;
+    }
+
+private:
+    FileCache() = default;
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<std::shared_ptr<const CachedFile>> lru;
+        std::unordered_map<std::string, std::list<std::shared_ptr<const CachedFile>>::iterator> index;
+        size_t bytes = 0;
+        // entries sent from an fd
+        size_t fds = 0;
+    };
+
+    int64_t revalidate_ticks() const {
+        return std::chrono::duration_cast<CachedClock::time_point::duration>(revalidate_interval_).count();
+    }
+
+    void Insert(Shard &shard, std::shared_ptr<const CachedFile> file) {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(file->path);
+        if (it != shard.index.end()) {
+            Uncharge(shard, **it->second);
+            shard.lru.erase(it->second);
+            shard.index.erase(it);
+        }
+        shard.bytes += file->Cost();
+        shard.fds += file->fd >= 0;
+        shard.lru.push_front(file);
+        shard.index.emplace(file->path, shard.lru.begin());
+        while ((shard.bytes > max_shard_bytes_ || shard.fds > max_shard_fds_) && shard.lru.size() > 1) {
+            auto &victim = shard.lru.back();
+            SPDLOG_LOGGER_DEBUG(logger, "file cache: evict {}", victim->path);
+            Uncharge(shard, *victim);
+            shard.index.erase(victim->path);
+            shard.lru.pop_back();
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    static void Uncharge(Shard &shard, const CachedFile &file) {
+        shard.bytes -= file.Cost();
+        shard.fds -= file.fd >= 0;
+    }
+
+    void Erase(Shard &shard, const std::string &path) {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(path);
+        if (it != shard.index.end()) {
+            Uncharge(shard, **it->second);
+            shard.lru.erase(it->second);
+            shard.index.erase(it);
+        }
+    }
+
+    std::array<Shard, kShards> shards_;
+    size_t max_shard_bytes_ = (64u << 20) / kShards;
+    size_t max_shard_fds_ = 1024 / kShards;
+    std::chrono::milliseconds revalidate_interval_{1000};
+    size_t sendfile_threshold_ = 64 * 1024;
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+    std::atomic<size_t> evictions_{0};
+};
@@ -1,13 +1,15 @@
 #pragma once
 
 #include <chrono>
+#include <clock.h>
 #include <cstddef>
 #include <functional>
 #include <unordered_map>
 #include <vector>
 
 using TimeOutCallBack = std::function<void()>;
-using Clock = std::chrono::system_clock;
+// monotonic, so setting the wall clock cannot expire every connection at once
+using Clock = CoarseClock;
 using TimeStamp = Clock::time_point;
 
 struct TimerNode {
@@ -20,24 +22,32 @@ struct TimerNode {
 };
 
 
+// Times are read from the thread's CachedClock, which the calling event loop
+// refreshes once per iteration.
 class HeapTimer {
 public:
     HeapTimer() = default;
     void Extend(int id, std::chrono::milliseconds timeout) {
-        heap_[ref_[id]].expire_time = Clock::now() + timeout;
-        ShiftDown(ref_[id]);
+        size_t index = ref_[id];
+        heap_[index].expire_time = CachedClock::Now() + timeout;
+        // a shorter timeout moves the node up, a longer one down
+        if (!ShiftUp(index)) {
+            ShiftDown(index);
+        }
     }
 
     void Add(int id, std::chrono::milliseconds timeout, const TimeOutCallBack& callback) {
-        heap_.emplace_back(id, Clock::now() + timeout, callback);
+        heap_.emplace_back(id, CachedClock::Now() + timeout, callback);
         ref_[id] = heap_.size() - 1;
+        ShiftUp(heap_.size() - 1);
     }
 
     int GetNextTick() {
-        Tick();
+        auto now = CachedClock::Now();
+        Tick(now);
         int res = -1;
         if (!heap_.empty()) {
-            res = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(heap_.front().expire_time - Clock::now()).count());
+            res = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(heap_.front().expire_time - now).count());
             if (res < 0) {
                 res = 0;
             }
@@ -61,7 +71,9 @@ private:
             SwapNode(index, heap_.size() - 1);
             ref_.erase(heap_.back().id);
             heap_.pop_back();
-            ShiftDown(index);
+            if (!ShiftUp(index)) {
+                ShiftDown(index);
+            }
         } else {
             ref_.erase(heap_.back().id);
             heap_.pop_back();
@@ -72,10 +84,10 @@ private:
         DelByIndex(0);
     }
 
-    void Tick() {
+    void Tick(TimeStamp now) {
         while (!heap_.empty()) {
             auto& node = heap_.front();
-            if (node.expire_time > Clock::now()) {
+            if (node.expire_time > now) {
                 break;
             }
             node.callback();
@@ -102,6 +114,20 @@ private:
         }
     }
 
+    // returns whether the node moved
+    bool ShiftUp(size_t index) {
+        size_t start = index;
+        while (index > 0) {
+            size_t parent = (index - 1) / 2;
+            if (!(heap_[index] < heap_[parent])) {
+                break;
+            }
+            SwapNode(index, parent);
+            index = parent;
+        }
+        return index != start;
+    }
+
     void SwapNode(size_t i, size_t j) {
         if (i == j) {
             return;
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+// Validators and conditional request checks (RFC 9110 section 13).
+
+// IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+inline std::string FormatHttpDate(time_t t) {
+    struct tm tm{};
+    gmtime_r(&t, &tm);
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, n);
+}
+
+// parses an IMF-fixdate, -1 if value is not one
+inline time_t ParseHttpDate(std::string_view value) {
+    std::string str(value);
+    struct tm tm{};
+    const char *end = strptime(str.data(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == nullptr || *end != '\0') {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+// strong validator derived from the modification time and size of a file
+inline std::string MakeEtag(time_t mtime, uint64_t size) {
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "\"%lx-%lx\"", static_cast<unsigned long>(mtime),
+                     static_cast<unsigned long>(size));
+    return std::string(buf, n);
+}
+
+// If-None-Match: "*" or a list of entity tags, compared weakly
+inline bool EtagListMatches(std::string_view list, std::string_view etag) {
+    auto opaque = [](std::string_view tag) {
+        if (tag.substr(0, 2) == "W/") {
+            tag.remove_prefix(2);
+        }
+        return tag;
+    };
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto tag = list.substr(0, comma);
+        list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+        while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) { tag.remove_prefix(1); }
+        while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) { tag.remove_suffix(1); }
+        if (tag == "*" || (!tag.empty() && opaque(tag) == opaque(etag))) {
+            return true;
+        }
+    }
+    return false;
+}
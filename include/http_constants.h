@@ -4,6 +4,12 @@
 #include <string_view>
 #include <algorithm>
 
+// Connection header lines shared by the dynamic and the pre-serialized
+// response headers
+inline constexpr std::string_view kKeepAliveHeader =
+    "Connection: keep-alive\r\nkeep-alive: max=6, timeout=120\r\n";
+inline constexpr std::string_view kCloseHeader = "Connection: close\r\n";
+
 inline std::string_view getHTTPStatusText(int status) {
     using namespace std::string_view_literals;
     static constexpr std::pair<int, std::string_view> kStatusMapping[] = {
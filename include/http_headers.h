@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Request headers the server looks at. Each one gets a fixed slot in the
+// parser's header table, so reading them needs neither hashing nor a search.
+enum class HTTP_HEADER : uint8_t {
+    ACCEPT_ENCODING,
+    CONNECTION,
+    CONTENT_LENGTH,
+    CONTENT_TYPE,
+    COOKIE,
+    HOST,
+    IF_MODIFIED_SINCE,
+    IF_NONE_MATCH,
+    IF_RANGE,
+    RANGE,
+    USER_AGENT,
+    UNKNOWN,
+};
+
+inline constexpr size_t kKnownHeaderCount = static_cast<size_t>(HTTP_HEADER::UNKNOWN);
+static_assert(kKnownHeaderCount <= 32, "presence of known headers is kept in a uint32_t");
+
+inline constexpr std::string_view kKnownHeaderNames[kKnownHeaderCount] = {
+    "Accept-Encoding",
+    "Connection",
+    "Content-Length",
+    "Content-Type",
+    "Cookie",
+    "Host",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "Range",
+    "User-Agent",
+};
+
+// folds only letters: or-ing 0x20 into any byte would also fold '@' into
+// '`', '[' into '{' and so on
+constexpr char AsciiLower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+}
+
+constexpr bool EqualsIgnoreCase(std::string_view lhs, std::string_view rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < lhs.size(); i++) {
+        if (AsciiLower(lhs[i]) != AsciiLower(rhs[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// maps a header name (case-insensitive) to its slot, or UNKNOWN
+constexpr HTTP_HEADER LookupHeader(std::string_view name) {
+    if (name.empty()) {
+        return HTTP_HEADER::UNKNOWN;
+    }
+    for (size_t i = 0; i < kKnownHeaderCount; i++) {
+        const auto &known = kKnownHeaderNames[i];
+        // the length and first letter rule out almost every candidate
+        if (known.size() == name.size() && AsciiLower(known[0]) == AsciiLower(name[0])
+            && EqualsIgnoreCase(known, name)) {
+            return static_cast<HTTP_HEADER>(i);
+        }
+    }
+    return HTTP_HEADER::UNKNOWN;
+}
+
+static_assert(LookupHeader("content-length") == HTTP_HEADER::CONTENT_LENGTH);
+static_assert(LookupHeader("X-Forwarded-For") == HTTP_HEADER::UNKNOWN);
+static_assert(LookupHeader("If\rRange") == HTTP_HEADER::UNKNOWN);
+static_assert(!EqualsIgnoreCase("@[^", "`{~"));
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <cstddef>
+#include <array>
+#include <cstdint>
+#include <http_headers.h>
+#include <simd_scan.h>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// first position in [p, end) holding one of the delimiters, or end
+template <char... Delims>
+inline const char *ScanUntil(const char *p, const char *end) {
+    static_assert(sizeof...(Delims) >= 1 && sizeof...(Delims) <= 3);
+    constexpr char d[] = {Delims...};
+    constexpr size_t n = sizeof...(Delims);
+    return FindFirstOf(p, end, d[0], d[n > 1 ? 1 : 0], d[n - 1]);
+}
+
+// Incremental, zero-copy parser for the head of an HTTP/1.x request.
+//
+// Parse() is handed the readable bytes of the read buffer, starting at the
+// first byte of the request. When the head is incomplete it remembers where it
+// stopped, and the next call (with more bytes appended) continues from there
+// instead of rescanning. Positions are stored as offsets from the start of the
+// request, so the buffer may move its storage between two calls; the
+// string_views returned by the accessors refer to the range passed to the last
+// Parse() call.
+//
+// Headers listed in HTTP_HEADER are stored in fixed slots; any other header
+// goes to a small flat list that keeps its capacity across requests.
+class HttpParser {
+public:
+    enum class PARSE_STATUS {
+        INCOMPLETE,
+        COMPLETE,
+        ERROR,
+    };
+
+    // a request head larger than this is rejected
+    static constexpr size_t kMaxHeadSize = 64 * 1024;
+    // a larger Content-Length is rejected before the body is waited for;
+    // the server only takes form posts
+    static constexpr size_t kMaxBodySize = 1024 * 1024;
+
+    HttpParser() { Reset(); }
+
+    void Reset() {
+        state_ = STATE::METHOD;
+        base_ = nullptr;
+        pos_ = mark_ = 0;
+        literal_idx_ = 0;
+        method_ = path_ = version_ = {};
+        header_name_ = {};
+        header_id_ = HTTP_HEADER::UNKNOWN;
+        present_ = 0;
+        unknown_headers_.clear();
+    }
+
+    PARSE_STATUS Parse(const char *begin, const char *end) {
+        base_ = begin;
+        const char *p = begin + pos_;
+        while (p < end && state_ != STATE::DONE) {
+            switch (state_) {
+                case STATE::METHOD: {
+                    p = ScanUntil<' ', '\r', '\n'>(p, end);
+                    if (p == end) { break; }
+                    if (*p != ' ' || Offset(p) == mark_) { return Fail(); }
+                    method_ = Cut(p);
+                    Mark(++p);
+                    state_ = STATE::PATH;
+                    break;
+                }
+                case STATE::PATH: {
+                    p = ScanUntil<' ', '\r', '\n'>(p, end);
+                    if (p == end) { break; }
+                    if (*p != ' ' || Offset(p) == mark_) { return Fail(); }
+                    path_ = Cut(p);
+                    p++;
+                    state_ = STATE::VERSION_PREFIX;
+                    break;
+                }
+                case STATE::VERSION_PREFIX: {
+                    static constexpr std::string_view kPrefix = "HTTP/";
+                    if (*p != kPrefix[literal_idx_]) { return Fail(); }
+                    p++;
+                    if (++literal_idx_ == kPrefix.size()) {
+                        Mark(p);
+                        state_ = STATE::VERSION;
+                    }
+                    break;
+                }
+                case STATE::VERSION: {
+                    p = ScanUntil<' ', '\r', '\n'>(p, end);
+                    if (p == end) { break; }
+                    if (*p != '\r' || Offset(p) == mark_) { return Fail(); }
+                    version_ = Cut(p);
+                    p++;
+                    state_ = STATE::REQUEST_LINE_LF;
+                    break;
+                }
+                case STATE::REQUEST_LINE_LF:
+                case STATE::HEADER_LF: {
+                    if (*p != '\n') { return Fail(); }
+                    Mark(++p);
+                    state_ = STATE::HEADER_NAME;
+                    break;
+                }
+                case STATE::HEADER_NAME: {
+                    p = ScanUntil<':', '\r', '\n'>(p, end);
+                    if (p == end) { break; }
+                    if (*p == '\r' && Offset(p) == mark_) {
+                        // empty line, end of the head
+                        p++;
+                        state_ = STATE::HEAD_END_LF;
+                        break;
+                    }
+                    if (*p != ':' || Offset(p) == mark_) { return Fail(); }
+                    header_name_ = Cut(p);
+                    header_id_ = LookupHeader(View(header_name_));
+                    p++;
+                    state_ = STATE::HEADER_VALUE_START;
+                    break;
+                }
+                case STATE::HEADER_VALUE_START: {
+                    while (p < end && (*p == ' ' || *p == '\t')) { p++; }
+                    if (p == end) { break; }
+                    Mark(p);
+                    state_ = STATE::HEADER_VALUE;
+                    break;
+                }
+                case STATE::HEADER_VALUE: {
+                    p = ScanUntil<'\r', '\n'>(p, end);
+                    if (p == end) { break; }
+                    if (*p != '\r') { return Fail(); }
+                    const char *value_end = p;
+                    while (Offset(value_end) > mark_
+                           && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+                        value_end--;
+                    }
+                    AddHeader(Cut(value_end));
+                    p++;
+                    state_ = STATE::HEADER_LF;
+                    break;
+                }
+                case STATE::HEAD_END_LF: {
+                    if (*p != '\n') { return Fail(); }
+                    p++;
+                    state_ = STATE::DONE;
+                    break;
+                }
+                case STATE::DONE:
+                case STATE::FAILED:
+                    break;
+            }
+        }
+        pos_ = Offset(p);
+        if (state_ == STATE::DONE) {
+            return PARSE_STATUS::COMPLETE;
+        }
+        if (state_ == STATE::FAILED || pos_ > kMaxHeadSize) {
+            return Fail();
+        }
+        return PARSE_STATUS::INCOMPLETE;
+    }
+
+    // true once the request line has been parsed
+    bool RequestLineDone() const {
+        return state_ > STATE::REQUEST_LINE_LF;
+    }
+
+    // size of the request head, including the empty line that ends it
+    size_t HeadLength() const {
+        return pos_;
+    }
+
+    std::string_view method() const { return View(method_); }
+
+    std::string_view path() const { return View(path_); }
+
+    std::string_view version() const { return View(version_); }
+
+    bool HasHeader(HTTP_HEADER id) const {
+        return present_ & (1u << static_cast<unsigned>(id));
+    }
+
+    // value of a known header, or empty
+    std::string_view Header(HTTP_HEADER id) const {
+        return HasHeader(id) ? View(known_headers_[static_cast<size_t>(id)]) : std::string_view{};
+    }
+
+    // value of the first header called name (case-insensitive), or empty
+    std::string_view Header(std::string_view name) const {
+        auto id = LookupHeader(name);
+        if (id != HTTP_HEADER::UNKNOWN) {
+            return Header(id);
+        }
+        for (const auto &[key, value] : unknown_headers_) {
+            if (EqualsIgnoreCase(View(key), name)) {
+                return View(value);
+            }
+        }
+        return {};
+    }
+
+    size_t UnknownHeaderCount() const {
+        return unknown_headers_.size();
+    }
+
+    std::pair<std::string_view, std::string_view> UnknownHeader(size_t i) const {
+        return {View(unknown_headers_[i].first), View(unknown_headers_[i].second)};
+    }
+
+private:
+    enum class STATE {
+        METHOD,
+        PATH,
+        VERSION_PREFIX,
+        VERSION,
+        REQUEST_LINE_LF,
+        HEADER_NAME,
+        HEADER_VALUE_START,
+        HEADER_VALUE,
+        HEADER_LF,
+        HEAD_END_LF,
+        DONE,
+        FAILED,
+    };
+
+    // a range of the request, relative to its first byte
+    struct Slice {
+        uint32_t off = 0;
+        uint32_t len = 0;
+    };
+
+    size_t Offset(const char *p) const {
+        return p - base_;
+    }
+
+    void Mark(const char *p) {
+        mark_ = Offset(p);
+    }
+
+    Slice Cut(const char *p) const {
+        return {static_cast<uint32_t>(mark_),
+                static_cast<uint32_t>(Offset(p) - mark_)};
+    }
+
+    std::string_view View(Slice s) const {
+        return {base_ + s.off, s.len};
+    }
+
+    void AddHeader(Slice value) {
+        if (header_id_ == HTTP_HEADER::UNKNOWN) {
+            unknown_headers_.emplace_back(header_name_, value);
+        } else if (!HasHeader(header_id_)) {
+            // a repeated header keeps its first value
+            known_headers_[static_cast<size_t>(header_id_)] = value;
+            present_ |= 1u << static_cast<unsigned>(header_id_);
+        }
+    }
+
+    PARSE_STATUS Fail() {
+        state_ = STATE::FAILED;
+        return PARSE_STATUS::ERROR;
+    }
+
+    STATE state_;
+    const char *base_;
+    size_t pos_;
+    size_t mark_;
+    size_t literal_idx_;
+    Slice method_, path_, version_;
+    Slice header_name_;
+    HTTP_HEADER header_id_;
+    uint32_t present_;
+    std::array<Slice, kKnownHeaderCount> known_headers_;
+    std::vector<std::pair<Slice, Slice>> unknown_headers_;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// an inclusive byte range of a response body
+struct ByteRange {
+    size_t first;
+    size_t last;
+
+    size_t Length() const {
+        return last - first + 1;
+    }
+};
+
+enum class RANGE_RESULT {
+    IGNORED,        // no usable Range header, send the whole body
+    SATISFIABLE,    // send the ranges with 206
+    UNSATISFIABLE,  // none of the ranges overlaps the body, send 416
+};
+
+// Parses a "Range: bytes=..." header value for a body of size bytes into
+// ranges, clamped to the body. Malformed headers, other units, requests for
+// more than kMaxRanges ranges and overlapping ranges asking for more bytes than
+// the body has are ignored, as RFC 9110 allows.
+inline RANGE_RESULT ParseRange(std::string_view value, size_t size, std::vector<ByteRange> &ranges) {
+    static constexpr size_t kMaxRanges = 16;
+    static constexpr std::string_view kUnit = "bytes=";
+    ranges.clear();
+    if (value.substr(0, kUnit.size()) != kUnit) {
+        return RANGE_RESULT::IGNORED;
+    }
+    value.remove_prefix(kUnit.size());
+
+    auto trim = [](std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) { s.remove_prefix(1); }
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) { s.remove_suffix(1); }
+        return s;
+    };
+    auto to_number = [](std::string_view s, size_t &n) {
+        auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), n);
+        return !s.empty() && ec == std::errc() && ptr == s.data() + s.size();
+    };
+
+    size_t specs = 0;
+    while (!value.empty()) {
+        auto comma = value.find(',');
+        auto spec = trim(value.substr(0, comma));
+        value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+        if (spec.empty()) {
+            continue;
+        }
+        if (++specs > kMaxRanges) {
+            ranges.clear();
+            return RANGE_RESULT::IGNORED;
+        }
+        auto dash = spec.find('-');
+        if (dash == std::string_view::npos) {
+            ranges.clear();
+            return RANGE_RESULT::IGNORED;
+        }
+        auto first_str = spec.substr(0, dash);
+        auto last_str = spec.substr(dash + 1);
+        size_t first = 0;
+        size_t last = 0;
+        if (first_str.empty()) {
+            // suffix range: the last n bytes
+            if (!to_number(last_str, last)) {
+                ranges.clear();
+                return RANGE_RESULT::IGNORED;
+            }
+            if (last == 0 || size == 0) {
+                continue;
+            }
+            ranges.push_back({last >= size ? 0 : size - last, size - 1});
+            continue;
+        }
+        if (!to_number(first_str, first)) {
+            ranges.clear();
+            return RANGE_RESULT::IGNORED;
+        }
+        if (last_str.empty()) {
+            last = size - 1;
+        } else if (!to_number(last_str, last) || last < first) {
+            ranges.clear();
+            return RANGE_RESULT::IGNORED;
+        }
+        if (first >= size) {
+            continue;
+        }
+        ranges.push_back({first, last >= size ? size - 1 : last});
+    }
+    if (specs == 0) {
+        return RANGE_RESULT::IGNORED;
+    }
+    size_t total = 0;
+    for (auto range : ranges) {
+        total += range.Length();
+    }
+    if (ranges.size() > 1 && total > size) {
+        ranges.clear();
+        return RANGE_RESULT::IGNORED;
+    }
+    return ranges.empty() ? RANGE_RESULT::UNSATISFIABLE : RANGE_RESULT::SATISFIABLE;
+}
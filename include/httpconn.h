@@ -2,95 +2,174 @@
 
 #include "httprequest.h"
 #include "utils.h"
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
 #include <netinet/in.h>
 #include <socket_descriptor.h>
 #include <spdlog/spdlog.h>
+#include <sys/socket.h>
 #include <buffer.h>
+#include <clock.h>
 #include <httpresponse.h>
+#include <output_queue.h>
+#include <timing_wheel.h>
 #include <unistd.h>
 #include <logger.h>
 class HttpConn {
 
 public:
+    // pipelined requests are parsed ahead only while less than this waits
+    // to be sent
+    static constexpr size_t kMaxPipelinedBytes = 1 << 20;
+
     HttpConn() = default;
 
-    void Init(std::unique_ptr<ServerSocket> sock, sockaddr_in addr) {
-        sock_ = std::move(sock);
-        addr = addr;
+    // takes ownership of fd
+    void Init(int fd, sockaddr_in addr) {
+        sock_ = ServerSocket(fd);
+        addr_ = addr;
+        id_ = next_id++;
         user_count++;
     }
 
+    // Closes the connection and readies the object for the next one. The
+    // buffers go back to the pool. Without close_socket the fd is only
+    // forgotten, for a socket that was closed by a queued io_uring close.
+    void Reset(bool close_socket = true) {
+        if (!sock_.isValid()) {
+            return;
+        }
+        if (close_socket) {
+            sock_.Close();
+        } else {
+            sock_.Release();
+        }
+        user_count--;
+        read_buff_.Release();
+        output_.Clear();
+        request_.Init();
+        response_.UnmapFile();
+        request_start_ = {};
+        access_log_.clear();
+        keep_alive_ = true;
+        writable_ = true;
+        parked_ = false;
+    }
+
+    // the timer hook and the epoll registration point at the object
     HttpConn(const HttpConn&) = delete;
     HttpConn& operator=(const HttpConn&) = delete;
-    HttpConn(HttpConn&&) = default;
-    HttpConn& operator=(HttpConn&&) = default;
     ssize_t Read(int& read_errno) {
-        return read_buff_.ReadFd(sock_->get(), read_errno);
+        return read_buff_.ReadFd(sock_.get(), read_errno);
+    }
+
+    // Gives the buffers back to the pool while the connection waits for its
+    // next request, so idle keep-alive connections hold no buffer memory.
+    void ReleaseIdleBuffers() {
+        if (read_buff_.ReadableBytes() == 0) {
+            read_buff_.Release();
+        }
+        if (output_.Empty()) {
+            output_.Clear();
+        }
+    }
+
+    // bytes received by a ring instead of Read(), false if the buffer
+    // limit leaves no room for them
+    bool Feed(const char *data, size_t len) {
+        return read_buff_.TryAppend(data, len);
     }
 
     size_t ToWriteBytes() {
-        return iov_[0].iov_len + iov_[1].iov_len;
+        return output_.Size();
+    }
+
+    // the queued memory for a send issued by a ring, see
+    // OutputQueue::Gather(); Wrote() drops what it took
+    int GatherWrite(struct iovec *iov, int max, bool &file_follows) {
+        return output_.Gather(iov, max, file_follows);
+    }
+
+    void Wrote(size_t len) {
+        output_.Advance(len);
     }
 
+    // Sends what is queued, see OutputQueue::Flush(). A file offset
+    // survives partial writes across EPOLLOUT events.
     ssize_t Write(int& error_no) {
-        ssize_t len = -1;
-        while (ToWriteBytes() > 0) {
-            len = writev(sock_->get(), iov_, iov_cnt_);
-            // SPDLOG_LOGGER_DEBUG(logger, "len: {}", len);
-            if (len <= 0) {
-                error_no = errno;
-                return len;
-            }
-            if (len > iov_[0].iov_len) {
-                iov_[1].iov_base = (uint8_t*)iov_[1].iov_base +  (len - iov_[0].iov_len);
-                iov_[1].iov_len -= (len - iov_[0].iov_len);
-                if (iov_[0].iov_len) {
-                    write_buff_.RetrieveAll();
-                    iov_[0].iov_len = 0;
-                }
-                // SPDLOG_LOGGER_DEBUG(logger, "*: {}, len: {}", iov_[1].iov_base, iov_[1].iov_len);
-            } else {
-                iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len;
-                iov_[0].iov_len -= len;
-                write_buff_.Retrieve(len);
-            }
-            // SPDLOG_LOGGER_DEBUG(logger, "iov0: {}, iov1: {}", iov_[0].iov_len, iov_[1].iov_len);
-        }
-        return len;
+        return output_.Flush(sock_.get(), error_no);
+    }
+
+    // Whether the socket is believed to take more bytes, for connections
+    // that stay registered for EPOLLOUT: cleared when a write would block,
+    // set again by the next EPOLLOUT edge.
+    bool IsWritable() const {
+        return writable_;
+    }
+
+    void SetWritable(bool writable) {
+        writable_ = writable;
     }
 
+    // false once a response asked to close the connection after it
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        return keep_alive_;
     }
 
+    // Parses every complete request in the read buffer and queues their
+    // responses in order, so pipelined requests go out with one flush.
+    // Stops early at a response that closes the connection, once the queue
+    // holds kMaxPipelinedBytes, or at a request that waits for the
+    // database; the rest stays in the buffer for the next call. Returns
+    // whether a response was queued.
     bool Process() {
-        if (request_.state() == HttpRequest::REQUEST_STATE::REQUEST_FINISH) {
-            request_.Init();
-        }
-        auto parse_status = request_.Parse(read_buff_);
-        if (parse_status == HttpRequest::HTTP_CODE::GET_REQUEST) {
-            SPDLOG_LOGGER_INFO(logger, request_.path());
-            response_.Init(src_dir, request_.path(), request_.IsKeepAlive(), 200);
-        } else if (parse_status == HttpRequest::HTTP_CODE::NO_REQUEST) {
-            return false;
-        } else {
-            response_.Init(src_dir, request_.path(), false, 400);
+        bool queued = false;
+        while (!parked_ && keep_alive_ && output_.Size() < kMaxPipelinedBytes && ProcessOne()) {
+            queued = true;
         }
+        return queued;
+    }
+
+    // A request that needs the user table parks the connection: nothing
+    // behind it is processed until Resume() answers it. The query is handed
+    // out once, to be run off the event loop.
+    bool IsParked() const {
+        return parked_;
+    }
+
+    std::optional<HttpRequest::UserQuery> TakeUserQuery() {
+        return parked_ ? request_.TakeUserQuery() : std::nullopt;
+    }
+
+    // queues the response of the parked request, Process() goes on with
+    // the ones behind it; only what HttpRequest copied out of read_buff_ is
+    // left of the request
+    void Resume(bool verified) {
+        request_.SetUserVerified(verified);
+        parked_ = false;
+        QueueResponse(true);
+    }
 
-        response_.MakeResponse(write_buff_);
-        // response header
-        iov_[0].iov_base = const_cast<char*>(write_buff_.Peak());
-        iov_[0].iov_len = write_buff_.ReadableBytes();
-        iov_cnt_ = 1;
-        // response body
-        if (response_.FileLen() > 0 && response_.File()) {
-            iov_[1].iov_base = response_.File();
-            iov_[1].iov_len = response_.FileLen();
-            iov_cnt_ = 2;
+    // tells a connection from the one that had its fd before
+    uint64_t Id() const {
+        return id_;
+    }
+
+    // One line per response once it is written: peer, status, path, bytes
+    // and the time from the request's first bytes to its last written one,
+    // both taken from the worker's CachedClock, so good to a jiffy.
+    void LogAccess() {
+        auto now = CachedClock::Now();
+        for (auto &entry : access_log_) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - entry.start);
+            SPDLOG_LOGGER_INFO(logger, "{} {} {} {}B {}ms", sockaddrToString(addr_), entry.code,
+                               entry.path, entry.bytes, elapsed.count());
         }
-        SPDLOG_LOGGER_INFO(logger, "filesize: {}, iovCnt: {}, Total: {} Bytes", response_.FileLen(), iov_cnt_, ToWriteBytes());
-        return true;
+        access_log_.clear();
     }
 
     bool Echo() {
@@ -99,35 +178,139 @@ public:
         }
         std::string read_data = read_buff_.RetrieveAllToStr();
         SPDLOG_LOGGER_INFO(logger, EscapeString(read_data));
-        write_buff_.Append(read_data);    
-        iov_[0].iov_base = const_cast<char*>(write_buff_.Peak());
-        iov_[0].iov_len = write_buff_.ReadableBytes();
-        iov_cnt_ = 1;
+        output_.Bytes().Append(read_data);
+        output_.PushBytes(read_data.size());
         return true;
     }
     int GetFd() {
-        return sock_->get();
+        return sock_.get();
     }
 
     ~HttpConn() {
-        user_count--;
+        Reset();
     }
 public:
     inline static bool isET = true;
     inline static std::string src_dir;
     inline static std::atomic<int> user_count = 0;
+    // idle timeout of the connection, armed in the worker's TimingWheel
+    TimerHook timer_hook;
 private:
-    std::unique_ptr<ServerSocket> sock_;
+    // a response and how the access log describes it
+    struct AccessEntry {
+        int code;
+        std::string path;
+        size_t bytes;
+        CachedClock::time_point start;
+    };
+
+    // Parses the next request in the read buffer and queues its response.
+    // Returns false if the buffer holds no complete request.
+    bool ProcessOne() {
+        if (read_buff_.ReadableBytes() == 0) {
+            return false;
+        }
+        if (request_.state() == HttpRequest::REQUEST_STATE::REQUEST_FINISH) {
+            request_.Init();
+        }
+        if (request_start_ == CachedClock::time_point{}) {
+            request_start_ = CachedClock::Now();
+        }
+        auto parse_status = request_.Parse(read_buff_);
+        if (parse_status == HttpRequest::HTTP_CODE::NO_REQUEST) {
+            return false;
+        }
+        if (parse_status == HttpRequest::HTTP_CODE::GET_REQUEST && request_.HasUserQuery()) {
+            parked_ = true;
+            return false;
+        }
+        QueueResponse(parse_status == HttpRequest::HTTP_CODE::GET_REQUEST);
+        return true;
+    }
+
+    // queues the response to the parsed request, a 400 unless valid
+    void QueueResponse(bool valid) {
+        if (valid) {
+            keep_alive_ = request_.IsKeepAlive();
+            response_.Init(src_dir, request_.path(), keep_alive_, 200);
+        } else {
+            keep_alive_ = false;
+            response_.Init(src_dir, request_.path(), false, 400);
+        }
+        // the headers are views into read_buff_; a request that was parked
+        // has none left, see HttpRequest::Parse()
+        if (request_.method() == "GET") {
+            response_.SetRange(request_.GetHeader(HTTP_HEADER::RANGE),
+                               request_.GetHeader(HTTP_HEADER::IF_RANGE));
+            response_.SetConditional(request_.GetHeader(HTTP_HEADER::IF_NONE_MATCH),
+                                     request_.GetHeader(HTTP_HEADER::IF_MODIFIED_SINCE));
+            response_.SetAcceptEncoding(request_.GetHeader(HTTP_HEADER::ACCEPT_ENCODING));
+        }
+
+        // the head goes after whatever is still queued
+        auto &bytes = output_.Bytes();
+        size_t queued = output_.Size();
+        size_t built = bytes.ReadableBytes();
+        response_.MakeResponse(bytes);
+        auto file = response_.FileRef();
+        // response head, either pre-serialized with the cached file or
+        // built in the queue's buffer
+        auto header = response_.PreparedHeader();
+        auto &parts = response_.Parts();
+        if (header.empty()) {
+            size_t part_heads = 0;
+            for (auto &part : parts) {
+                part_heads += part.head_len;
+            }
+            output_.PushBytes(bytes.ReadableBytes() - built - part_heads);
+        } else {
+            output_.PushMemory(header.data(), header.size(), file);
+        }
+        PushBody(response_.BodyOffset(), response_.BodyLen(), file);
+        // a multipart body, its part heads between the ranges
+        for (auto &part : parts) {
+            output_.PushBytes(part.head_len);
+            PushBody(part.offset, part.len, file);
+        }
+        size_t response_bytes = output_.Size() - queued;
+        SPDLOG_LOGGER_DEBUG(logger, "filesize: {}, Total: {} Bytes", response_.FileLen(), response_bytes);
+        if (logger->should_log(spdlog::level::info)) {
+            access_log_.push_back({response_.Code(), request_.path(), response_bytes, request_start_});
+        }
+        request_start_ = {};
+    }
+
+    // Queues len bytes of the response's file from offset, mapped or sent
+    // from the cached fd. A file that shrank meanwhile fails the send, see
+    // OutputQueue::Flush().
+    void PushBody(size_t offset, size_t len, const std::shared_ptr<const CachedFile> &file) {
+        if (len > 0 && response_.File()) {
+            output_.PushMemory(response_.File() + offset, len, file);
+        } else if (len > 0 && response_.FileFd() >= 0) {
+            output_.PushFile(response_.FileFd(), offset, len, file);
+        }
+    }
+
+    ServerSocket sock_{-1};
     struct sockaddr_in addr_;
 
     bool is_close_{};
 
-    int iov_cnt_{};
-    struct iovec iov_[2]{};
-
     Buffer read_buff_;
-    Buffer write_buff_;
-    
+    // responses waiting to be sent
+    OutputQueue output_;
+
+    // when the request being parsed started to arrive, zero between requests
+    CachedClock::time_point request_start_{};
+    // queued responses, logged once they are written
+    std::vector<AccessEntry> access_log_;
+    bool keep_alive_ = true;
+    bool writable_ = true;
+    // waiting for the database, see IsParked()
+    bool parked_ = false;
+    uint64_t id_ = 0;
+    inline static std::atomic<uint64_t> next_id = 1;
+
     HttpRequest request_;
     HttpResponse response_;
 };
\ No newline at end of file
@@ -1,7 +1,8 @@
 #pragma once
 #include "sqlconnpool.h"
 #include <cassert>
-#include <regex>
+#include <credential_cache.h>
+#include <charconv>
 #include <spdlog/spdlog.h>
 #include <string>
 #include <unordered_map>
@@ -9,9 +10,20 @@
 #include <buffer.h>
 #include <algorithm>
 #include <http_constants.h>
+#include <http_parser.h>
 #include <logger.h>
+#include <optional>
+#include <utility>
 class HttpRequest {
 public:
+    // a login or registration to check against the user table
+    struct UserQuery {
+        std::string name;
+        std::string password;
+        bool is_login;
+        // CachedUserVerify() found no entry, UserVerify() need not look again
+        bool cache_missed = false;
+    };
 
     enum class REQUEST_STATE {
         REQUEST_LINE,
@@ -33,73 +45,68 @@ public:
 
     HttpRequest() { Init(); }
     void Init() {
-        method_ = path_ = version_ = body_ = "";
+        method_.clear();
+        version_.clear();
+        path_.clear();
+        body_.clear();
+        content_length_ = 0;
+        keep_alive_ = false;
         state_ = REQUEST_STATE::REQUEST_LINE;
-        header_.clear();
+        parser_.Reset();
         post_.clear();
+        user_query_.reset();
     }
 
     bool IsKeepAlive() const {
-        return version_ == "1.1" || header_.contains("Connection") && header_.at("Connection") == "keep-alive";
+        return keep_alive_;
     }
 
     auto state() const {
         return state_;
     }
-    HTTP_CODE Parse(Buffer &buff) {
-        const std::string CRLF = "\r\n";
 
-        while (buff.ReadableBytes() && state_ != REQUEST_STATE::REQUEST_FINISH) {
-            if (state_ != REQUEST_STATE::REQUEST_BODY) {
-                const char *line_end = std::search(
-                    buff.Peak(), buff.BeginWrite(), CRLF.begin(), CRLF.end());
-                if (line_end == buff.BeginWrite()) {
-                    return HTTP_CODE::NO_REQUEST;
-                }
-                std::string line(buff.Peak(), line_end);
-                SPDLOG_LOGGER_DEBUG(logger, line);
-                if (state_ == REQUEST_STATE::REQUEST_LINE) {
-                    if (!ParseRequestLine(line)) {
-                        return HTTP_CODE::BAD_REQUEST;
-                    }
-                    ParsePath();
-                } else {
-                    assert(state_ == REQUEST_STATE::REQUEST_HEADERS);
-                    if (line.empty()) {
-                        if (method_ == "GET") {
-                            state_ = REQUEST_STATE::REQUEST_FINISH;
-                        } else if (method_ == "POST") {
-                            state_ = HttpRequest::REQUEST_STATE::REQUEST_BODY;
-                        } else {
-                            SPDLOG_LOGGER_ERROR(logger, "unknown request method: {}", method_);
-                            return HttpRequest::HTTP_CODE::BAD_REQUEST;
-                        }
-                    } else {
-                        if (!ParseHeader(line)) {
-                            return HTTP_CODE::BAD_REQUEST;
-                        }
-                    }
-                }
-                buff.RetrieveUntil(line_end + 2);
-            } else {
-                assert(method_ == "POST");
-                if (!header_.contains("Content-Length")) {
-                    return HTTP_CODE::BAD_REQUEST;
-                }
-                auto len = std::stoll(header_["Content-Length"]);
-                if (buff.ReadableBytes() < len) {
-                    return HTTP_CODE::NO_REQUEST;
-                }
-                std::string body(buff.Peak(), buff.Peak() + len);
-                ParseBody(std::move(body));
-                buff.RetrieveUntil(buff.Peak() + len);
+    // The head of the request stays in the buffer until the whole request has
+    // arrived, so the parser can resume where it stopped and the string_views
+    // it hands out keep pointing at the request bytes. They stay valid until
+    // the buffer is written to again. The method, version and keep-alive
+    // flag are copied, they are needed after that.
+    HTTP_CODE Parse(Buffer &buff) {
+        if (state_ == REQUEST_STATE::REQUEST_LINE
+            || state_ == REQUEST_STATE::REQUEST_HEADERS) {
+            auto status = parser_.Parse(buff.Peak(), buff.BeginWrite());
+            if (status == HttpParser::PARSE_STATUS::ERROR) {
+                SPDLOG_LOGGER_ERROR(logger, "RequestLine Error");
+                return HTTP_CODE::BAD_REQUEST;
+            }
+            if (parser_.RequestLineDone()) {
+                state_ = REQUEST_STATE::REQUEST_HEADERS;
+            }
+            if (status == HttpParser::PARSE_STATUS::INCOMPLETE) {
+                return HTTP_CODE::NO_REQUEST;
+            }
+            if (!ParseRequestLine()) {
+                return HTTP_CODE::BAD_REQUEST;
             }
         }
+        if (state_ == REQUEST_STATE::REQUEST_BODY) {
+            size_t head_len = parser_.HeadLength();
+            if (buff.ReadableBytes() < head_len + content_length_) {
+                return HTTP_CODE::NO_REQUEST;
+            }
+            ParseBody(std::string(buff.Peak() + head_len, content_length_));
+        }
 
-        if (state_ == REQUEST_STATE::REQUEST_FINISH) {
-            return HTTP_CODE::GET_REQUEST;
+        // HTTP/1.1 connections persist unless the client asks to close
+        auto connection = parser_.Header(HTTP_HEADER::CONNECTION);
+        keep_alive_ = version_ == "1.1" ? !EqualsIgnoreCase(connection, "close")
+                                        : EqualsIgnoreCase(connection, "keep-alive");
+        buff.Retrieve(parser_.HeadLength() + content_length_);
+        if (user_query_) {
+            // the request is answered once the database has been asked, by
+            // then its bytes are gone from the buffer, and so are the views
+            parser_.Reset();
         }
-        return HTTP_CODE::NO_REQUEST;
+        return HTTP_CODE::GET_REQUEST;
     }
 
     void ParsePath() {
@@ -114,30 +121,37 @@ public:
             }
         }
     }
-    
-    // POST / HTTP/1.1
-    bool ParseRequestLine(const std::string& line) {
-        std::regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-        std::smatch sub_match;
-        if (std::regex_match(line, sub_match, pattern)) {
-            method_ = sub_match[1];
-            path_ = sub_match[2];
-            version_ = sub_match[3];
-            state_ = REQUEST_STATE::REQUEST_HEADERS;
-            return true;
-        }
-        SPDLOG_LOGGER_ERROR(logger, "RequestLine Error");
-        return false;
-    }
 
-    bool ParseHeader(const std::string& line) {
-        std::regex pattern("^([^:]*): ?(.*)$");
-        std::smatch sub_match;
-        if (std::regex_match(line, sub_match, pattern)) {
-            header_[sub_match[1]] = sub_match[2];
-            return true;
+    // POST / HTTP/1.1
+    bool ParseRequestLine() {
+        method_.assign(parser_.method());
+        path_.assign(parser_.path());
+        version_.assign(parser_.version());
+        SPDLOG_LOGGER_DEBUG(logger, "{} {} HTTP/{}", method_, path_, version_);
+        ParsePath();
+        if (method_ == "GET") {
+            state_ = REQUEST_STATE::REQUEST_FINISH;
+        } else if (method_ == "POST") {
+            auto len = parser_.Header(HTTP_HEADER::CONTENT_LENGTH);
+            size_t length = 0;
+            auto [ptr, ec] = std::from_chars(len.data(), len.data() + len.size(), length);
+            if (len.empty() || ec != std::errc() || ptr != len.data() + len.size()) {
+                SPDLOG_LOGGER_ERROR(logger, "invalid Content-Length: {}", len);
+                return false;
+            }
+            // bounds the buffer a connection may grow and what Parse() adds
+            // to the head length
+            if (length > HttpParser::kMaxBodySize) {
+                SPDLOG_LOGGER_ERROR(logger, "Content-Length too large: {}", len);
+                return false;
+            }
+            content_length_ = length;
+            state_ = REQUEST_STATE::REQUEST_BODY;
+        } else {
+            SPDLOG_LOGGER_ERROR(logger, "unknown request method: {}", method_);
+            return false;
         }
-        return false;
+        return true;
     }
 
     void ParseBody(std::string body) {
@@ -181,78 +195,144 @@ public:
         return result;
     }
     void ParsePost() {
-        if (method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+        if (method_ == "POST" && parser_.Header(HTTP_HEADER::CONTENT_TYPE) == "application/x-www-form-urlencoded") {
             post_ = parse_form_data(body_);
             if (DEFAULT_HTML_TAG.contains(path_)) {
                 int tag = DEFAULT_HTML_TAG.at(path_);
                 if (tag == 0 || tag == 1) {
                     bool isLogin = (tag == 1);
-                    if (UserVerify(post_["username"], post_["password"], isLogin)) {
-                        path_ = "/welcome.html";
-                    } else {
+                    auto &name = post_["username"];
+                    auto &pwd = post_["password"];
+                    if (name.empty() || pwd.empty()) {
                         path_ = "/error.html";
+                    } else {
+                        // the database is asked off the event loop, see
+                        // DbExecutor, and the verdict set with SetUserVerified()
+                        user_query_ = UserQuery{name, pwd, isLogin};
                     }
                 }
             }
         }
     }
 
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin) {
+    // the query the request waits on, which is handed out once
+    std::optional<UserQuery> TakeUserQuery() {
+        return std::exchange(user_query_, std::nullopt);
+    }
+
+    bool HasUserQuery() const {
+        return user_query_.has_value();
+    }
+
+    // answers the request with the welcome or the error page
+    void SetUserVerified(bool verified) {
+        path_ = verified ? "/welcome.html" : "/error.html";
+    }
+
+    // Blocks on the connection pool and the database, so it must not run on
+    // a worker's event loop. cache_missed skips the CredentialCache, which
+    // was just asked, so that a login counts one miss.
+    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin,
+                           bool cache_missed = false) {
         SPDLOG_LOGGER_DEBUG(logger, "name: {}, password: {}", name, pwd);
         if (name.empty() || pwd.empty()) {
             return false;
         }
-        MySqlScopedConnection conn(MysqlConnectionPool::GetInstance());
-        auto query = conn->query();
-        query << "SELECT password FROM user WHERE username = " << mysqlpp::quote << name << " LIMIT 1";
-        mysqlpp::StoreQueryResult result = query.store();
-
-        if (result.num_rows() == 1) {
-            if (!isLogin) {
-                SPDLOG_LOGGER_INFO(logger, "User exsited");
-                return false;
-            }
-            mysqlpp::Row row = result[0];
-            std::string password = std::string(row["password"]);
-            
-            if (password == pwd) {
-                return true;
-            }
-            SPDLOG_LOGGER_INFO(logger, "password incorrect");
-            return false;
+        auto &cache = CredentialCache::GetInstance();
+        std::optional<std::string> password;
+        if (cache_missed || !cache.Lookup(name, password)) {
+            MySqlScopedConnection conn(MysqlConnectionPool::GetInstance());
+            // prepared once per pooled connection, the name and password are
+            // sent as bound parameters
+            password = conn.Statement(SQL_STATEMENT::SELECT_PASSWORD).SelectString({name});
+            cache.Put(name, password);
         }
+
         if (isLogin) {
-            SPDLOG_LOGGER_INFO(logger, "NOT FOUND");
+            return CheckLogin(password, pwd);
+        }
+        if (password) {
+            SPDLOG_LOGGER_INFO(logger, "User exsited");
             return false;
         }
 
-        query << "INSERT INTO user(username, password) VALUES(" << mysqlpp::quote << name
-                << ", " << mysqlpp::quote << pwd << ")";
-        if (query.execute()) {
-            SPDLOG_LOGGER_INFO(logger, "DB writed");
-            return true;
+        MySqlScopedConnection conn(MysqlConnectionPool::GetInstance());
+        try {
+            if (conn.Statement(SQL_STATEMENT::INSERT_USER).Execute({name, pwd}) == 1) {
+                SPDLOG_LOGGER_INFO(logger, "DB writed");
+                cache.Put(name, pwd);
+                return true;
+            }
+        } catch (...) {
+            // most likely someone else registered the name meanwhile
+            cache.Erase(name);
+            throw;
         }
         SPDLOG_LOGGER_INFO(logger, "DB write failed");
         return false;
     }
+
+    // The verdict on a login the CredentialCache can give without the
+    // database, cheap enough for the event loop. Registrations always go to
+    // UserVerify(). A miss is recorded in query.
+    static std::optional<bool> CachedUserVerify(UserQuery &query) {
+        std::optional<std::string> password;
+        if (!query.is_login) {
+            return std::nullopt;
+        }
+        if (!CredentialCache::GetInstance().Lookup(query.name, password)) {
+            query.cache_missed = true;
+            return std::nullopt;
+        }
+        return CheckLogin(password, query.password);
+    }
+
     const std::string& path() const {
         return path_;
     }
 
-    const std::string& method() const {
+    std::string_view method() const {
         return method_;
     }
 
-    const std::string& version() const {
+    std::string_view version() const {
         return version_;
     }
 
+    // value of the request header, or empty; only until the buffer the
+    // request was parsed from is written to, see Parse()
+    std::string_view GetHeader(HTTP_HEADER id) const {
+        return parser_.Header(id);
+    }
+
+    std::string_view GetHeader(std::string_view name) const {
+        return parser_.Header(name);
+    }
+
 private:
+    // pwd against the stored password, nullopt if there is no such user
+    static bool CheckLogin(const std::optional<std::string> &password, const std::string &pwd) {
+        if (!password) {
+            SPDLOG_LOGGER_INFO(logger, "NOT FOUND");
+            return false;
+        }
+        if (*password == pwd) {
+            return true;
+        }
+        SPDLOG_LOGGER_INFO(logger, "password incorrect");
+        return false;
+    }
+
 
     REQUEST_STATE state_;
-    std::string method_, path_, version_, body_;
-    std::unordered_map<std::string, std::string> header_;
+    HttpParser parser_;
+    // short enough not to allocate
+    std::string method_, version_;
+    std::string path_, body_;
+    size_t content_length_;
+    bool keep_alive_;
     std::unordered_map<std::string, std::string> post_;
+    std::optional<UserQuery> user_query_;
 
     inline static const std::unordered_set<std::string> DEFAULT_HTML{
             "/index", "/register", "/login",
@@ -1,53 +1,100 @@
 #pragma once
 
 #include "buffer.h"
-#include <fcntl.h>
+#include <file_cache.h>
+#include <memory>
 #include <spdlog/spdlog.h>
 #include <string>
 #include <string_view>
 #include <sys/stat.h>
-#include <sys/mman.h>
 #include <unordered_map>
 #include <http_constants.h>
+#include <http_range.h>
 #include <unistd.h>
+#include <variant_cache.h>
+#include <vector>
 #include <utils.h>
 #include <logger.h>
 class HttpResponse {
 public:
     HttpResponse() {}
 
-    ~HttpResponse() {
-        UnmapFile();
-    }
-
+    // drops this response's reference to the cached file body
     void UnmapFile() {
-        if (mm_file_) {
-            munmap(mm_file_, mm_file_stat_.st_size);
-            mm_file_ = nullptr;
-        }
+        file_.reset();
     }
 
     void Init(const std::string& src_dir, const std::string& path, bool is_keep_alive, int code) {
-        if (mm_file_) {
-            UnmapFile();
-        }
+        UnmapFile();
         code_ = code;
         is_keep_alive_ = is_keep_alive;
         path_ = path;
         src_dir_ = src_dir;
-        mm_file_ = nullptr;
-        mm_file_stat_ = {};
+        range_ = if_range_ = if_none_match_ = if_modified_since_ = accept_encoding_ = {};
+        body_offset_ = body_len_ = 0;
+        parts_.clear();
+    }
+
+    // Range header of the request; the view must stay valid until
+    // MakeResponse() returns
+    void SetRange(std::string_view range, std::string_view if_range) {
+        range_ = range;
+        if_range_ = if_range;
     }
 
+    // conditional request headers, with the same lifetime rule as SetRange
+    void SetConditional(std::string_view if_none_match, std::string_view if_modified_since) {
+        if_none_match_ = if_none_match;
+        if_modified_since_ = if_modified_since;
+    }
+
+    // Accept-Encoding header of the request, same lifetime rule as SetRange
+    void SetAcceptEncoding(std::string_view accept_encoding) {
+        accept_encoding_ = accept_encoding;
+    }
+
+    // Writes the response head into buff. A 200 or 304 response for a cached
+    // file writes nothing, its pre-serialized head is returned by
+    // PreparedHeader().
     void MakeResponse(Buffer& buff) {
-        if (stat((src_dir_ + path_).data(), &mm_file_stat_) < 0 || S_ISDIR(mm_file_stat_.st_mode)) {
+        file_ = FileCache::GetInstance().Get(src_dir_ + path_);
+        if (!file_) {
             code_ = 404;
-        } else if (!(mm_file_stat_.st_mode & S_IROTH)) {
+        } else if (!(file_->st.st_mode & S_IROTH)) {
             code_ = 403;
         } else if (code_ == -1) {
             code_ = 200;
         }
 
+        // ranges are always served from the identity body
+        if (code_ == 200 && range_.empty() && !accept_encoding_.empty()) {
+            auto variant = VariantCache::GetInstance().Select(file_, AcceptedEncodings(accept_encoding_));
+            if (variant) {
+                file_ = std::move(variant);
+            }
+        }
+        if (code_ == 200 && NotModified()) {
+            code_ = 304;
+            return;
+        }
+        if (code_ == 200 && !range_.empty() && IfRangeMatches()) {
+            auto result = ParseRange(range_, file_->size, ranges_);
+            if (result == RANGE_RESULT::SATISFIABLE) {
+                code_ = 206;
+            } else if (result == RANGE_RESULT::UNSATISFIABLE) {
+                code_ = 416;
+            }
+        }
+
+        if (code_ == 200) {
+            body_len_ = file_->size;
+            return;
+        }
+        if (code_ == 206 || code_ == 416) {
+            AddStatusLine(buff);
+            AddRangeContent(buff);
+            return;
+        }
         ErrorHtml();
         AddStatusLine(buff);
         AddHeader(buff);
@@ -55,11 +102,34 @@ public:
 
     }
 
+    // RFC 9110 13.2.2: If-None-Match wins over If-Modified-Since
+    bool NotModified() const {
+        if (!if_none_match_.empty()) {
+            return EtagListMatches(if_none_match_, file_->etag);
+        }
+        if (!if_modified_since_.empty()) {
+            time_t since = ParseHttpDate(if_modified_since_);
+            return since != -1 && file_->st.st_mtime <= since;
+        }
+        return false;
+    }
+
+    // a Range is only honored if If-Range still names the current file
+    bool IfRangeMatches() const {
+        if (if_range_.empty()) {
+            return true;
+        }
+        if (if_range_.front() == '"') {
+            return if_range_ == file_->etag;
+        }
+        return if_range_ == file_->last_modified;
+    }
+
     void ErrorHtml() {
         if (ERRORCODE_PATH.contains(code_)) {
             SPDLOG_LOGGER_WARN(logger, "ERRORHTML");
             path_ = ERRORCODE_PATH.at(code_);
-            stat((src_dir_ + path_).data(), &mm_file_stat_);
+            file_ = FileCache::GetInstance().Get(src_dir_ + path_);
         }
     }
 
@@ -71,39 +141,77 @@ public:
     }
 
     void AddHeader(Buffer& buff) {
-        std::string header;
-        header += "Connection: ";
-        if (is_keep_alive_) {
-            header += "keep-alive\r\n";
-            header += "keep-alive: max=6, timeout=120\r\n";
+        std::string header{is_keep_alive_ ? kKeepAliveHeader : kCloseHeader};
+
+        if (file_) {
+            header += file_->content_type_header;
         } else {
-            header += "close\r\n";
+            header += "Content-type: " + GetFileType() + "\r\n";
         }
-
-        header += "Content-type: " + GetFileType() + "\r\n";
         SPDLOG_LOGGER_DEBUG(logger, EscapeString(header));
         buff.Append(header);
     }
 
     void AddContent(Buffer& buff) {
-        int src_fd  = open((src_dir_ + path_).data(), O_RDONLY);
-        if (src_fd < 0) {
+        if (!file_) {
             ErrorContent(buff, "File Not Found!");
             return;
         }
+        SPDLOG_LOGGER_DEBUG(logger, EscapeString(file_->content_length_header));
+        buff.Append(file_->content_length_header);
+        body_len_ = file_->size;
+    }
 
-        int* mmret = (int*)mmap(0, mm_file_stat_.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
-        if (*mmret == -1) {
-            close(src_fd);
-            ErrorContent(buff, "File Not Found!");
+    // Head of a 206 or 416 response. A single range is sent from the cached
+    // body like a whole file. For several ranges the head is followed by the
+    // part heads of a multipart/byteranges body, each of which Parts() pairs
+    // with its range of the cached body, so that the ranges are queued like
+    // a whole file and never copied.
+    void AddRangeContent(Buffer& buff) {
+        std::string header{is_keep_alive_ ? kKeepAliveHeader : kCloseHeader};
+        std::string total = std::to_string(file_->size);
+        if (code_ == 416) {
+            header += "Content-Range: bytes */" + total + "\r\n";
+            header += "Content-length: 0\r\n\r\n";
+            buff.Append(header);
             return;
         }
-        mm_file_ = (char*) mmret;
-        close(src_fd);
-        std::string header = "Content-length: " + std::to_string(mm_file_stat_.st_size) + "\r\n\r\n"; 
-        SPDLOG_LOGGER_DEBUG(logger, EscapeString(header));
+        header += file_->validator_headers;
+        header += file_->vary_header;
+        if (ranges_.size() == 1) {
+            auto range = ranges_.front();
+            header += file_->content_type_header;
+            header += "Content-Range: bytes " + std::to_string(range.first) + "-"
+                      + std::to_string(range.last) + "/" + total + "\r\n";
+            header += "Content-length: " + std::to_string(range.Length()) + "\r\n\r\n";
+            buff.Append(header);
+            body_offset_ = range.first;
+            body_len_ = range.Length();
+            return;
+        }
+
+        std::vector<std::string> part_heads;
+        size_t body_size = 0;
+        for (auto range : ranges_) {
+            part_heads.push_back(
+                "\r\n--" + std::string(kBoundary) + "\r\n" + file_->content_type_header
+                + "Content-Range: bytes " + std::to_string(range.first) + "-"
+                + std::to_string(range.last) + "/" + total + "\r\n\r\n");
+            body_size += part_heads.back().size() + range.Length();
+        }
+        std::string tail = "\r\n--" + std::string(kBoundary) + "--\r\n";
+        body_size += tail.size();
+        header += "Content-type: multipart/byteranges; boundary=" + std::string(kBoundary) + "\r\n";
+        header += "Content-length: " + std::to_string(body_size) + "\r\n\r\n";
         buff.Append(header);
+        for (size_t i = 0; i < ranges_.size(); i++) {
+            buff.Append(part_heads[i]);
+            parts_.push_back({part_heads[i].size(), ranges_[i].first, ranges_[i].Length()});
+        }
+        buff.Append(tail);
+        parts_.push_back({tail.size(), 0, 0});
     }
+
     std::string GetFileType() {
         auto idx = path_.find_last_of('.');
         if (idx == std::string::npos) {
@@ -112,12 +220,60 @@ public:
         return GetContentTypeByExtension(path_.substr(idx));
     }
 
-    char* File() {
-        return mm_file_;
+    // pre-serialized head of this response, empty if it was written by
+    // MakeResponse
+    std::string_view PreparedHeader() const {
+        if (code_ == 200 && file_) {
+            return file_->Header(is_keep_alive_);
+        }
+        if (code_ == 304 && file_) {
+            return file_->NotModifiedHeader(is_keep_alive_);
+        }
+        return {};
+    }
+
+    // the cached file the head and body borrow from, nullptr if none
+    const std::shared_ptr<const CachedFile>& FileRef() const {
+        return file_;
+    }
+
+    const char* File() const {
+        return file_ ? file_->data : nullptr;
+    }
+
+    // fd to sendfile(2) the body from, -1 if the body is mapped
+    int FileFd() const {
+        return file_ ? file_->fd : -1;
+    }
+
+    int Code() const {
+        return code_;
     }
 
     size_t FileLen() const {
-        return mm_file_stat_.st_size;
+        return file_ ? file_->size : 0;
+    }
+
+    // the part of the cached file that goes out after the head
+    size_t BodyOffset() const {
+        return body_offset_;
+    }
+
+    size_t BodyLen() const {
+        return body_len_;
+    }
+
+    // A part of a multipart body: head_len bytes written by MakeResponse(),
+    // then len bytes of the cached file from offset. The part heads come
+    // last in the buffer, after the response head.
+    struct BodyPart {
+        size_t head_len;
+        size_t offset;
+        size_t len;
+    };
+
+    const std::vector<BodyPart>& Parts() const {
+        return parts_;
     }
 
     void ErrorContent(Buffer& buff, std::string message) {
@@ -137,8 +293,18 @@ private:
     bool is_keep_alive_ = false;
     std::string path_;
     std::string src_dir_;
-    char* mm_file_ = nullptr;
-    struct stat mm_file_stat_{};
+    std::shared_ptr<const CachedFile> file_;
+    std::string_view range_;
+    std::string_view if_range_;
+    std::string_view if_none_match_;
+    std::string_view if_modified_since_;
+    std::string_view accept_encoding_;
+    std::vector<ByteRange> ranges_;
+    size_t body_offset_ = 0;
+    size_t body_len_ = 0;
+    std::vector<BodyPart> parts_;
+
+    static constexpr std::string_view kBoundary = "MINISERVER_BYTERANGES";
 
     inline static const std::unordered_map<int, std::string> ERRORCODE_PATH = {
         {400, "/400.html"},
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <logger.h>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+
+// A completion-based alternative to Epoller on io_uring(7), driven through
+// the raw syscalls so that it needs nothing beyond the kernel headers.
+// Operations are queued as SQEs and none reaches the kernel before
+// SubmitAndWait(), which submits everything queued since the last call and
+// waits for completions in the same io_uring_enter, so a whole event loop
+// iteration costs one syscall. Completions are read back with
+// ForEachCompletion() and carry the user_data given when they were queued.
+//
+// Receives pick their memory from a provided buffer ring, so an idle
+// connection pins no buffer while a receive is armed on it.
+//
+// Not thread-safe: the ring is meant to be created, fed and reaped by the
+// thread that runs the loop (IORING_SETUP_SINGLE_ISSUER).
+class IoUringReactor {
+public:
+    explicit IoUringReactor(unsigned entries = 4096) {
+        struct io_uring_params params{};
+        // multishot receives and accepts complete many times per SQE
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+        params.cq_entries = entries * 4;
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd_ < 0 && errno == EINVAL) {
+            // kernels before 6.1 know neither flag
+            params = {};
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = entries * 4;
+            ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        }
+        if (ring_fd_ < 0) {
+            throw std::system_error(errno, std::generic_category());
+        }
+        if (!(params.features & IORING_FEAT_EXT_ARG)) {
+            close(ring_fd_);
+            throw std::system_error(ENOSYS, std::generic_category(), "io_uring without IORING_FEAT_EXT_ARG");
+        }
+        SPDLOG_LOGGER_DEBUG(logger, "IoUringReactor create: {}, sq: {}, cq: {}",
+                            ring_fd_, params.sq_entries, params.cq_entries);
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = Map(sq_ring_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = (params.features & IORING_FEAT_SINGLE_MMAP)
+                       ? sq_ring_ : Map(cq_ring_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe *>(Map(sqes_size_, IORING_OFF_SQES));
+
+        auto *sq = static_cast<char *>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        // SQE i always sits in slot i
+        auto *array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries_; i++) {
+            array[i] = i;
+        }
+        sqe_tail_ = *sq_tail_;
+
+        auto *cq = static_cast<char *>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    }
+
+    IoUringReactor(const IoUringReactor &) = delete;
+    IoUringReactor &operator=(const IoUringReactor &) = delete;
+
+    ~IoUringReactor() {
+        SPDLOG_LOGGER_DEBUG(logger, "IoUringReactor close: {}", ring_fd_);
+        // closing the ring cancels whatever is still in flight
+        close(ring_fd_);
+        if (buf_ring_) {
+            munmap(buf_ring_, buf_ring_size_);
+            munmap(bufs_, size_t{buf_count_} * buf_size_);
+        }
+        munmap(sqes_, sqes_size_);
+        if (cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        munmap(sq_ring_, sq_ring_size_);
+    }
+
+    // Registers count buffers of size bytes as buffer group group, for
+    // receives queued with RecvMultishot(). count must be a power of two.
+    void SetupBufferRing(uint16_t group, unsigned count, unsigned size) {
+        buf_ring_size_ = count * sizeof(struct io_uring_buf);
+        buf_ring_ = static_cast<struct io_uring_buf *>(
+            mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (buf_ring_ == MAP_FAILED) {
+            buf_ring_ = nullptr;
+            throw std::system_error(errno, std::generic_category());
+        }
+        bufs_ = static_cast<char *>(
+            mmap(nullptr, size_t{count} * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (bufs_ == MAP_FAILED) {
+            munmap(buf_ring_, buf_ring_size_);
+            buf_ring_ = nullptr;
+            throw std::system_error(errno, std::generic_category());
+        }
+        buf_count_ = count;
+        buf_size_ = size;
+
+        struct io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            throw std::system_error(errno, std::generic_category());
+        }
+        for (unsigned i = 0; i < count; i++) {
+            RecycleBuffer(static_cast<uint16_t>(i));
+        }
+    }
+
+    // the memory of provided buffer bid, as named by a completion
+    const char *BufferData(uint16_t bid) const {
+        return bufs_ + size_t{bid} * buf_size_;
+    }
+
+    // hands buffer bid back to the kernel once its bytes are consumed
+    void RecycleBuffer(uint16_t bid) {
+        auto &buf = buf_ring_[buf_tail_ & (buf_count_ - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(BufferData(bid));
+        buf.len = buf_size_;
+        buf.bid = bid;
+        buf_tail_++;
+        // the ring's tail overlays the first entry's resv field
+        std::atomic_ref<uint16_t>(buf_ring_[0].resv).store(buf_tail_, std::memory_order_release);
+    }
+
+    // buffer id of a completion that carries one, -1 otherwise
+    static int CompletionBuffer(const struct io_uring_cqe &cqe) {
+        return (cqe.flags & IORING_CQE_F_BUFFER) ? static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    }
+
+    // whether the multishot request of a completion stays armed
+    static bool CompletionMore(const struct io_uring_cqe &cqe) {
+        return cqe.flags & IORING_CQE_F_MORE;
+    }
+
+    // accepts connections on listen_fd until it fails, one completion each
+    // with the new fd, already SOCK_NONBLOCK | SOCK_CLOEXEC
+    void AcceptMultishot(int listen_fd, uint64_t user_data) {
+        auto *sqe = GetSqe(IORING_OP_ACCEPT, listen_fd, user_data);
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    }
+
+    // receives into buffers of group until the socket is at EOF or fails,
+    // one completion per receive
+    void RecvMultishot(int fd, uint16_t group, uint64_t user_data) {
+        auto *sqe = GetSqe(IORING_OP_RECV, fd, user_data);
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = group;
+    }
+
+    void Read(int fd, void *buf, unsigned len, uint64_t user_data) {
+        auto *sqe = GetSqe(IORING_OP_READ, fd, user_data);
+        sqe->addr = reinterpret_cast<uint64_t>(buf);
+        sqe->len = len;
+        sqe->off = static_cast<uint64_t>(-1);
+    }
+
+    // msg and what it points at must stay put until the completion, which
+    // may report a short send
+    void SendMsg(int fd, const struct msghdr *msg, int flags, uint64_t user_data) {
+        auto *sqe = GetSqe(IORING_OP_SENDMSG, fd, user_data);
+        sqe->addr = reinterpret_cast<uint64_t>(msg);
+        sqe->len = 1;
+        sqe->msg_flags = static_cast<uint32_t>(flags);
+    }
+
+    // one-shot poll for mask (POLLIN, POLLOUT...)
+    void PollAdd(int fd, unsigned mask, uint64_t user_data) {
+        auto *sqe = GetSqe(IORING_OP_POLL_ADD, fd, user_data);
+        sqe->poll32_events = mask;
+    }
+
+    void Close(int fd, uint64_t user_data) {
+        GetSqe(IORING_OP_CLOSE, fd, user_data);
+    }
+
+    // cancels the request queued with target as its user_data
+    void Cancel(uint64_t target, uint64_t user_data) {
+        auto *sqe = GetSqe(IORING_OP_ASYNC_CANCEL, -1, user_data);
+        sqe->addr = target;
+    }
+
+    // cancels every request on fd
+    void CancelFd(int fd, uint64_t user_data) {
+        auto *sqe = GetSqe(IORING_OP_ASYNC_CANCEL, fd, user_data);
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    }
+
+    // Submits what is queued and waits up to timeout_ms (forever if
+    // negative) for a completion, all in one io_uring_enter.
+    void SubmitAndWait(int timeout_ms) {
+        unsigned to_submit = FlushSq();
+        long res;
+        if (timeout_ms < 0) {
+            res = Enter(to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        } else {
+            struct __kernel_timespec ts{};
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+            struct io_uring_getevents_arg arg{};
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+            res = Enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        }
+        // ETIME is the timeout, EBUSY a full completion queue that the
+        // caller is about to drain
+        if (res < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            throw std::system_error(errno, std::generic_category());
+        }
+        if (res > 0) {
+            pending_ -= std::min(pending_, static_cast<unsigned>(res));
+        }
+    }
+
+    // calls f with every completion that has arrived, returns their number
+    template <class F>
+    unsigned ForEachCompletion(F &&f) {
+        unsigned head = *cq_head_;
+        unsigned tail = std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+        unsigned count = tail - head;
+        for (; head != tail; head++) {
+            // a copy, as f may queue operations that submit and let the
+            // kernel reuse the slot
+            struct io_uring_cqe cqe = cqes_[head & cq_mask_];
+            std::atomic_ref<unsigned>(*cq_head_).store(head + 1, std::memory_order_release);
+            f(cqe);
+        }
+        return count;
+    }
+
+private:
+    void *Map(size_t size, uint64_t offset) const {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, static_cast<off_t>(offset));
+        if (ptr == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category());
+        }
+        return ptr;
+    }
+
+    long Enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) const {
+        return syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, arg, arg_size);
+    }
+
+    // a zeroed SQE in the next slot; a full queue is submitted first
+    struct io_uring_sqe *GetSqe(uint8_t opcode, int fd, uint64_t user_data) {
+        unsigned head = std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire);
+        if (sqe_tail_ - head == sq_entries_) {
+            long res = Enter(FlushSq(), 0, 0, nullptr, 0);
+            if (res < 0) {
+                throw std::system_error(errno, std::generic_category());
+            }
+            pending_ -= std::min(pending_, static_cast<unsigned>(res));
+        }
+        auto *sqe = &sqes_[sqe_tail_ & sq_mask_];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->user_data = user_data;
+        sqe_tail_++;
+        return sqe;
+    }
+
+    // publishes the queued SQEs, returns how many await submission
+    unsigned FlushSq() {
+        unsigned published = *sq_tail_;
+        pending_ += sqe_tail_ - published;
+        std::atomic_ref<unsigned>(*sq_tail_).store(sqe_tail_, std::memory_order_release);
+        return pending_;
+    }
+
+    int ring_fd_ = -1;
+    void *sq_ring_ = nullptr;
+    void *cq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    struct io_uring_sqe *sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned *sq_head_ = nullptr;
+    unsigned *sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    // SQEs filled, published to the kernel by FlushSq()
+    unsigned sqe_tail_ = 0;
+    // published SQEs the kernel has not taken yet
+    unsigned pending_ = 0;
+
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    struct io_uring_cqe *cqes_ = nullptr;
+
+    struct io_uring_buf *buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    char *bufs_ = nullptr;
+    unsigned buf_count_ = 0;
+    unsigned buf_size_ = 0;
+    uint16_t buf_tail_ = 0;
+};
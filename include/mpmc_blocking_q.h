@@ -1,77 +1,143 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
-#include <condition_variable>
-#include <mutex>
-#include <queue>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <memory>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
 
+// Bounded multi-producer multi-consumer queue on a ring of sequence-numbered
+// cells (D. Vyukov's design). Producers and consumers claim positions with a
+// CAS on their own cache line and only meet on the cell they hand over, so
+// neither side takes a lock. Threads block only when the queue is full or
+// empty: they count themselves as waiting and sleep on a futex word, which
+// the other side bumps, with a wake-up syscall, only when it finds someone
+// waiting. In the common case an operation costs its CAS and one fence.
 class thread_pool;
 template <typename T>
 class mpmc_blocking_queue {
 public:
     friend class thread_pool;
     using item_type = T;
+    // throws std::invalid_argument for a queue without room
     explicit mpmc_blocking_queue(size_t max_items)
-        : max_items(max_items) {}
+        : max_items(max_items), cells(std::make_unique<cell[]>(max_items)) {
+        if (max_items == 0) {
+            throw std::invalid_argument("mpmc_blocking_queue needs room for an item");
+        }
+        for (size_t i = 0; i < max_items; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    mpmc_blocking_queue(const mpmc_blocking_queue &) = delete;
+    mpmc_blocking_queue &operator=(const mpmc_blocking_queue &) = delete;
 
+    // block policy: waits while the queue is full
     void enqueue(T&& item) {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            pop_cv.wait(lock, [this] { return this->q.size() != max_items; });
-            q.push(std::move(item));
+        while (!try_enqueue(item)) {
+            if (park(pop_seq, producers_waiting, [&] { return try_enqueue(item); }, nullptr)) {
+                return;
+            }
         }
-        push_cv.notify_one();
     }
 
+    // overrun_oldest policy: makes room by dropping the oldest item
     void enqueue_nowait(T&& item) {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            if (q.size() == max_items && q.size() > 0) {
-                q.pop();
+        while (!try_enqueue(item)) {
+            T dropped;
+            if (try_dequeue(dropped)) {
                 ++m_overrun_counter;
             }
-            q.push(std::move(item));
         }
-        push_cv.notify_one();
     }
 
+    // discard_new policy: drops item if the queue is full
     void enqueue_if_have_room(T&& item) {
-        bool pushed = false;
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            if (q.size() != max_items) {
-                q.push(std::move(item));
-                pushed = true;
-            }
-        }
-        if (pushed) {
-            push_cv.notify_one();
-        } else {
+        if (!try_enqueue(item)) {
             ++m_discard_counter;
         }
     }
 
     bool dequeue_for(T& popped_item, std::chrono::milliseconds wait_duration) {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            if (!push_cv.wait_for(lock, wait_duration, [this] { return !q.empty(); })) {
+        auto deadline = std::chrono::steady_clock::now() + wait_duration;
+        while (!try_dequeue(popped_item)) {
+            auto left = deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::nanoseconds::zero()) {
                 return false;
             }
-            popped_item = std::move(q.front());
-            q.pop();
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+            struct timespec timeout{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+            if (park(push_seq, consumers_waiting, [&] { return try_dequeue(popped_item); }, &timeout)) {
+                return true;
+            }
         }
-        pop_cv.notify_one();
         return true;
     }
 
     void dequeue(T& popped_item) {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            push_cv.wait(lock, [this] { return !q.empty(); });
-            popped_item = std::move(q.front());
-            q.pop();
+        while (!try_dequeue(popped_item)) {
+            if (park(push_seq, consumers_waiting, [&] { return try_dequeue(popped_item); }, nullptr)) {
+                return;
+            }
         }
-        pop_cv.notify_one();
+    }
+
+    // Moves item in and returns true if there was room. Leaves item alone
+    // otherwise.
+    bool try_enqueue(T& item) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true) {
+            c = &cells[pos % max_items];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // the cell still holds the item from a lap ago: full
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = std::move(item);
+        c->sequence.store(pos + 1, std::memory_order_release);
+        notify(push_seq, consumers_waiting);
+        return true;
+    }
+
+    bool try_dequeue(T& popped_item) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true) {
+            c = &cells[pos % max_items];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // nothing has been written here yet: empty
+                return false;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        popped_item = std::move(c->data);
+        c->sequence.store(pos + max_items, std::memory_order_release);
+        notify(pop_seq, producers_waiting);
+        return true;
     }
 
     size_t overrun_counter() {
@@ -80,9 +146,11 @@ public:
     size_t discard_counter() {
         return m_discard_counter.load(std::memory_order_relaxed);
     }
+    // a snapshot, other threads may change it at any moment
     size_t size() {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        return q.size();
+        size_t tail = dequeue_pos.load(std::memory_order_acquire);
+        size_t head = enqueue_pos.load(std::memory_order_acquire);
+        return head > tail ? std::min(head - tail, max_items) : 0;
     }
     void reset_overrun_counter() {
         m_overrun_counter.store(0, std::memory_order_relaxed);
@@ -91,12 +159,56 @@ public:
         m_discard_counter.store(0, std::memory_order_relaxed);
     }
 private:
-    std::mutex queue_mutex;
-    std::condition_variable push_cv;
-    std::condition_variable pop_cv;
-    std::queue<T> q;
+    struct alignas(64) cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    // Called after a push (pop) is published: wakes a thread parked on seq,
+    // if any. A push (pop) makes room for one thread to go on, so one is
+    // woken; the others stay asleep. The fence pairs with the one in park():
+    // either this sees the waiter, or the parking thread's last ready()
+    // check sees the push.
+    static void notify(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiting) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) > 0) {
+            seq.fetch_add(1, std::memory_order_seq_cst);
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+    }
+
+    // Counts itself as waiting, checks ready() once more and sleeps on seq if
+    // it still fails, until notified or timeout (relative, nullptr waits for
+    // good) passes. Returns what ready() returned. The count covers the
+    // whole wait, so a notify() for one thread leaves the others waited for.
+    template <typename Ready>
+    static bool park(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiting, Ready &&ready,
+                     const struct timespec *timeout) {
+        waiting.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // acquire: a bump read here makes the push it announces visible
+        uint32_t seen = seq.load(std::memory_order_acquire);
+        bool done = ready();
+        if (!done) {
+            // returns at once if a notify() bumped seq since it was read
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAIT_PRIVATE, seen, timeout, nullptr, 0);
+        }
+        waiting.fetch_sub(1, std::memory_order_relaxed);
+        return done;
+    }
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words are 32 bits");
+
     size_t max_items{0};
-    std::atomic<size_t> m_discard_counter{0};
+    std::unique_ptr<cell[]> cells;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+    // futex words, bumped only to wake parked threads, and how many
+    // consumers (producers) wait for the next push (pop)
+    alignas(64) std::atomic<uint32_t> push_seq{0};
+    std::atomic<uint32_t> consumers_waiting{0};
+    alignas(64) std::atomic<uint32_t> pop_seq{0};
+    std::atomic<uint32_t> producers_waiting{0};
+    alignas(64) std::atomic<size_t> m_discard_counter{0};
     std::atomic<size_t> m_overrun_counter{0};
-    
-};
\ No newline at end of file
+};
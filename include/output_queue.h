@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <buffer.h>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// What a connection has left to send, as a queue of segments: bytes written
+// into the queue's own Buffer, memory owned by someone else (a cached file's
+// body or pre-serialized head) and file ranges to sendfile(2). Segments that
+// borrow memory or an fd hold a reference to its owner, so the queue may
+// outlive the response that filled it and several responses can wait in it
+// at once. Flush() sends everything up to the next file range with one
+// sendmsg of up to IOV_MAX entries.
+class OutputQueue {
+public:
+    OutputQueue() = default;
+    OutputQueue(const OutputQueue &) = delete;
+    OutputQueue &operator=(const OutputQueue &) = delete;
+
+    // Bytes appended here are queued by PushBytes(). They are sent in the
+    // order they were appended, so a segment only records its length.
+    Buffer &Bytes() {
+        return bytes_;
+    }
+
+    // queues the last len bytes appended to Bytes()
+    void PushBytes(size_t len) {
+        if (len == 0) {
+            return;
+        }
+        if (!segments_.empty() && segments_.back().kind == KIND::BYTES) {
+            segments_.back().len += len;
+        } else {
+            segments_.push_back({KIND::BYTES, nullptr, -1, 0, len, nullptr});
+        }
+        size_ += len;
+    }
+
+    // queues len bytes at data, kept alive by owner
+    void PushMemory(const char *data, size_t len, std::shared_ptr<const void> owner) {
+        if (len == 0) {
+            return;
+        }
+        segments_.push_back({KIND::MEMORY, data, -1, 0, len, std::move(owner)});
+        size_ += len;
+    }
+
+    // queues len bytes of fd from offset, the fd kept open by owner
+    void PushFile(int fd, off_t offset, size_t len, std::shared_ptr<const void> owner) {
+        if (len == 0) {
+            return;
+        }
+        segments_.push_back({KIND::FILE, nullptr, fd, offset, len, std::move(owner)});
+        size_ += len;
+    }
+
+    // bytes still to send
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Sends until the queue is empty, returning the bytes sent, or until the
+    // socket fails, returning -1 with error_no set (EAGAIN when it is full).
+    // Memory goes out with sendmsg; while a file range follows it is flagged
+    // MSG_MORE so that the kernel can merge it with the first file segment.
+    ssize_t Flush(int sock, int &error_no) {
+        ssize_t total = 0;
+        while (!segments_.empty()) {
+            auto &front = segments_.front();
+            if (front.kind == KIND::FILE) {
+                ssize_t len = sendfile(sock, front.fd, &front.offset, front.len);
+                if (len <= 0) {
+                    // the file shrank under us if sendfile returns 0
+                    error_no = len == 0 ? EIO : errno;
+                    return -1;
+                }
+                Consume(len);
+                total += len;
+                continue;
+            }
+            struct iovec iov[IOV_MAX];
+            bool more = false;
+            int iov_cnt = Gather(iov, IOV_MAX, more);
+            struct msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iov_cnt;
+            ssize_t len = sendmsg(sock, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+            if (len <= 0) {
+                error_no = errno;
+                return -1;
+            }
+            Consume(len);
+            total += len;
+        }
+        return total;
+    }
+
+    // Describes up to max entries of the memory queued ahead of the first
+    // file range in iov, for a send issued elsewhere, and sets file_follows
+    // if a file range ends it. Returns 0 when a file range is at the front.
+    // Advance() drops what the send took.
+    int Gather(struct iovec *iov, int max, bool &file_follows) {
+        int iov_cnt = 0;
+        file_follows = false;
+        const char *bytes = bytes_.Peak();
+        for (auto &segment : segments_) {
+            if (segment.kind == KIND::FILE) {
+                file_follows = true;
+                break;
+            }
+            if (iov_cnt == max) {
+                break;
+            }
+            if (segment.kind == KIND::BYTES) {
+                iov[iov_cnt++] = {const_cast<char *>(bytes), segment.len};
+                bytes += segment.len;
+            } else {
+                iov[iov_cnt++] = {const_cast<char *>(segment.data), segment.len};
+            }
+        }
+        return iov_cnt;
+    }
+
+    // drops len bytes sent from what Gather() described
+    void Advance(size_t len) {
+        Consume(len);
+    }
+
+    // drops everything queued and gives the buffer back to the pool
+    void Clear() {
+        segments_.clear();
+        size_ = 0;
+        bytes_.Release();
+    }
+
+private:
+    enum class KIND {BYTES, MEMORY, FILE};
+
+    struct Segment {
+        KIND kind;
+        const char *data;
+        int fd;
+        off_t offset;
+        size_t len;
+        std::shared_ptr<const void> owner;
+    };
+
+    // drops len sent bytes from the front; a file segment has already
+    // advanced its offset
+    void Consume(size_t len) {
+        size_ -= len;
+        while (len > 0) {
+            auto &front = segments_.front();
+            size_t n = std::min(len, front.len);
+            if (front.kind == KIND::BYTES) {
+                bytes_.Retrieve(n);
+            } else if (front.kind == KIND::MEMORY) {
+                front.data += n;
+            }
+            front.len -= n;
+            len -= n;
+            if (front.len == 0) {
+                segments_.pop_front();
+            }
+        }
+        if (bytes_.ReadableBytes() == 0) {
+            bytes_.RetrieveAll();
+        }
+    }
+
+    Buffer bytes_;
+    std::deque<Segment> segments_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <mysql/errmsg.h>
+#include <mysql/mysql.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The statements the server runs, each prepared once per pooled connection.
+enum class SQL_STATEMENT {
+    SELECT_PASSWORD,
+    INSERT_USER,
+};
+
+// A server-side prepared statement on one connection. The SQL is parsed by
+// the server once, when the statement is prepared; afterwards only the
+// parameters go over the wire, as strings, and need no escaping. Not thread
+// safe, like the connection it belongs to.
+class PreparedStatement {
+public:
+    // throws std::runtime_error if the server refuses the statement
+    PreparedStatement(MYSQL *mysql, std::string_view sql)
+        : stmt_(mysql_stmt_init(mysql)) {
+        if (stmt_ == nullptr) {
+            throw std::runtime_error(mysql_error(mysql));
+        }
+        if (mysql_stmt_prepare(stmt_, sql.data(), sql.size()) != 0) {
+            std::string error = mysql_stmt_error(stmt_);
+            mysql_stmt_close(stmt_);
+            throw std::runtime_error(error);
+        }
+        param_count_ = mysql_stmt_param_count(stmt_);
+    }
+
+    PreparedStatement(const PreparedStatement &) = delete;
+    PreparedStatement &operator=(const PreparedStatement &) = delete;
+
+    ~PreparedStatement() {
+        mysql_stmt_close(stmt_);
+    }
+
+    // Runs a statement without a result set and returns the rows it
+    // changed.
+    uint64_t Execute(std::initializer_list<std::string_view> params) {
+        Run(params);
+        return mysql_stmt_affected_rows(stmt_);
+    }
+
+    // Runs a query and returns the first column of its first row, as a
+    // string, or nullopt if there is no row.
+    std::optional<std::string> SelectString(std::initializer_list<std::string_view> params) {
+        Run(params);
+        std::string value(kResultBuffer, '\0');
+        unsigned long length = 0;
+        MYSQL_BIND result{};
+        result.buffer_type = MYSQL_TYPE_STRING;
+        result.buffer = value.data();
+        result.buffer_length = value.size();
+        result.length = &length;
+        if (mysql_stmt_bind_result(stmt_, &result) != 0) {
+            Fail();
+        }
+        int status = mysql_stmt_fetch(stmt_);
+        if (status == 1) {
+            Fail();
+        }
+        std::optional<std::string> column;
+        if (status != MYSQL_NO_DATA) {
+            if (status == MYSQL_DATA_TRUNCATED && length > value.size()) {
+                value.resize(length);
+                result.buffer = value.data();
+                result.buffer_length = value.size();
+                if (mysql_stmt_fetch_column(stmt_, &result, 0, 0) != 0) {
+                    Fail();
+                }
+            }
+            value.resize(length);
+            column = std::move(value);
+        }
+        // drops the rows after the first, the statement is ready for the
+        // next run
+        mysql_stmt_free_result(stmt_);
+        return column;
+    }
+
+    // The connection under the statement is gone and so is the statement,
+    // which needs to be prepared again once it is back.
+    bool Broken() const {
+        return broken_;
+    }
+
+private:
+    // the column bytes fetched without a second round, longer values are
+    // fetched again in full
+    static constexpr size_t kResultBuffer = 256;
+
+    void Run(std::initializer_list<std::string_view> params) {
+        if (params.size() != param_count_) {
+            throw std::invalid_argument("wrong number of statement parameters");
+        }
+        std::vector<MYSQL_BIND> binds(params.size());
+        std::vector<unsigned long> lengths(params.size());
+        size_t i = 0;
+        for (auto param : params) {
+            lengths[i] = param.size();
+            binds[i].buffer_type = MYSQL_TYPE_STRING;
+            binds[i].buffer = const_cast<char *>(param.data());
+            binds[i].buffer_length = param.size();
+            binds[i].length = &lengths[i];
+            i++;
+        }
+        if (!binds.empty() && mysql_stmt_bind_param(stmt_, binds.data()) != 0) {
+            Fail();
+        }
+        if (mysql_stmt_execute(stmt_) != 0) {
+            Fail();
+        }
+    }
+
+    [[noreturn]] void Fail() {
+        unsigned int error_no = mysql_stmt_errno(stmt_);
+        broken_ = error_no == CR_SERVER_GONE_ERROR || error_no == CR_SERVER_LOST;
+        std::string error = mysql_stmt_error(stmt_);
+        mysql_stmt_reset(stmt_);
+        throw std::runtime_error(error);
+    }
+
+    MYSQL_STMT *stmt_;
+    unsigned long param_count_ = 0;
+    bool broken_ = false;
+};
+
+// The statements prepared on one pooled connection, by SQL_STATEMENT. A
+// statement is prepared when it is first used and kept as long as the
+// connection.
+class StatementCache {
+public:
+    explicit StatementCache(MYSQL *mysql) : mysql_(mysql) {}
+
+    PreparedStatement &Get(SQL_STATEMENT id) {
+        auto &statement = statements_[static_cast<size_t>(id)];
+        if (!statement || statement->Broken()) {
+            statement.reset();
+            statement = std::make_unique<PreparedStatement>(mysql_, kSql[static_cast<size_t>(id)]);
+        }
+        return *statement;
+    }
+
+private:
+    static constexpr size_t kStatements = 2;
+    static constexpr std::array<std::string_view, kStatements> kSql = {
+        "SELECT password FROM user WHERE username = ? LIMIT 1",
+        "INSERT INTO user(username, password) VALUES(?, ?)",
+    };
+
+    MYSQL *mysql_;
+    std::array<std::unique_ptr<PreparedStatement>, kStatements> statements_;
+};
@@ -2,8 +2,17 @@
 
 #include <chrono>
 #include <cstdint>
+#include <dispatch_policy.h>
 #include <spdlog/common.h>
 #include <sys/epoll.h>
+
+// what a worker's event loop runs on; IO_URING needs a build with
+// MINISERVER_HAS_IO_URING, without it the workers stay on EPOLL
+enum class IO_BACKEND {
+    EPOLL,
+    IO_URING,
+};
+
 class Setting {
 public:
     static Setting &GetInstance() {
@@ -55,7 +64,13 @@ public:
 
     void InitEventMode() {
         listen_event = EPOLLRDHUP | EPOLLIN;
-        conn_event = EPOLLONESHOT | EPOLLRDHUP;
+        if (epoll_oneshot) {
+            conn_event = EPOLLONESHOT | EPOLLRDHUP;
+        } else {
+            // registered once for both directions; only edges can tell a
+            // socket that became writable from one that stayed writable
+            conn_event = EPOLLRDHUP | EPOLLIN | EPOLLOUT | EPOLLET;
+        }
 
         if (isET) {
             listen_event |= EPOLLET;
@@ -80,10 +95,46 @@ public:
     bool openLog;
     spdlog::level::level_enum logLevel;
     int logQueSize;
+    // granularity of connection timeouts, timers due within a tick expire
+    // together
+    std::chrono::milliseconds timer_tick{100};
     uint32_t listen_event;
     uint32_t conn_event;
+    // Re-arm connections with epoll_ctl after every event (EPOLLONESHOT).
+    // Off, a connection is registered once, edge-triggered whatever isET
+    // says, and whether its socket can take more bytes is tracked by the
+    // worker, which saves the epoll_ctl calls. Read by InitEventMode().
+    bool epoll_oneshot = true;
+    IO_BACKEND io_backend = IO_BACKEND::EPOLL;
     const int MaxFd = 65536;
     const int backlog = 10000;
+    // every worker accepts on its own SO_REUSEPORT listener instead of the
+    // main thread accepting and handing connections over
+    bool reuse_port = false;
+    // locks the database connection pool is split over, see
+    // MysqlConnectionPool
+    int db_pool_shards = 1;
+    // usernames whose user table record is cached and for how long, see
+    // CredentialCache; 0 entries turn it off
+    size_t credential_cache_entries = 64 * 1024;
+    std::chrono::seconds credential_cache_ttl{60};
+    // how the main thread picks a worker for a new connection
+    DISPATCH_POLICY dispatch_policy = DISPATCH_POLICY::ROUND_ROBIN;
+    // memory budget and disk recheck interval of the static file cache
+    size_t file_cache_bytes = 64 << 20;
+    std::chrono::milliseconds file_cache_revalidate{1000};
+    // files at least this large are sent with sendfile(2) instead of mmap
+    size_t sendfile_threshold = 64 * 1024;
+    // files the cache keeps open to sendfile(2) from, 0 for a sixteenth of
+    // RLIMIT_NOFILE
+    size_t file_cache_fds = 0;
+    // memory budget of gzip/br variants and the largest file compressed on
+    // the fly; precompressed .gz/.br siblings are used at any size
+    size_t variant_cache_bytes = 16 << 20;
+    size_t compress_max_file_bytes = 4 << 20;
+    // memory all connection buffers may hold together; past it requests are
+    // turned away with 503
+    size_t buffer_memory_limit = 256 << 20;
 private:
     Setting() = default;
 };
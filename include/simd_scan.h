@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Delimiter scanning for the request parser: finds the first byte in
+// [p, end) equal to one of three delimiters (repeat one to look for fewer).
+// The SSE2 and AVX2 versions compare 16/32 bytes per step and finish the tail
+// with the scalar loop. The implementation is picked once at startup from
+// what the CPU supports.
+
+inline const char *FindFirstOfScalar(const char *p, const char *end, char a, char b, char c) {
+    while (p < end && *p != a && *p != b && *p != c) {
+        p++;
+    }
+    return p;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+inline const char *FindFirstOfSse2(const char *p, const char *end, char a, char b, char c) {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)),
+            _mm_cmpeq_epi8(chunk, vc));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return FindFirstOfScalar(p, end, a, b, c);
+}
+
+__attribute__((target("avx2")))
+inline const char *FindFirstOfAvx2(const char *p, const char *end, char a, char b, char c) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    const __m256i vc = _mm256_set1_epi8(c);
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)),
+            _mm256_cmpeq_epi8(chunk, vc));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return FindFirstOfSse2(p, end, a, b, c);
+}
+
+#endif
+
+using FindFirstOfFn = const char *(*)(const char *, const char *, char, char, char);
+
+struct FindFirstOfImpl {
+    FindFirstOfFn fn;
+    std::string_view name;
+};
+
+inline FindFirstOfImpl SelectFindFirstOf() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {FindFirstOfAvx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return {FindFirstOfSse2, "sse2"};
+    }
+#endif
+    return {FindFirstOfScalar, "scalar"};
+}
+
+inline const FindFirstOfImpl kFindFirstOf = SelectFindFirstOf();
+
+inline const char *FindFirstOf(const char *p, const char *end, char a, char b, char c) {
+    return kFindFirstOf.fn(p, end, a, b, c);
+}
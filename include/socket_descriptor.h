@@ -7,6 +7,7 @@
 #include <sys/socket.h> // For socket, bind, listen, accept
 #include <system_error>
 #include <unistd.h> // For close()
+#include <utility>
 #include <logger.h>
 struct Connection
 {
@@ -20,6 +21,30 @@ static std::string sockaddrToString(const struct sockaddr_in &addr) {
     return std::string(ipstr);
 }
 
+// best-effort 503 for a connection the server has no room for
+inline void ServerBusy(int fd) {
+    static const std::string response =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Type: text/html; charset=utf-8\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "<!DOCTYPE html>\r\n"
+        "<html lang=\"en\">\r\n"
+        "<head>\r\n"
+        "    <meta charset=\"UTF-8\">\r\n"
+        "    <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\r\n"
+        "    <title>Service Unavailable</title>\r\n"
+        "</head>\r\n"
+        "<body>\r\n"
+        "    <h1>503 Service Unavailable</h1>\r\n"
+        "    <p>The server is currently unable to handle the request due to a temporary overload or maintenance of the server. Please try again later.</p>\r\n"
+        "</body>\r\n"
+        "</html>\r\n";
+
+    ssize_t ret = send(fd, response.data(), response.length(), MSG_NOSIGNAL);
+    if (ret < 0) { logger->error("send error to client [{}] error!", fd); }
+}
+
 class ServerSocket {
 private:
     int sockfd = -1;
@@ -53,12 +78,12 @@ public:
     }
 
     ~ServerSocket() {
-        SPDLOG_LOGGER_INFO(logger, "close socket: {}", sockfd);
         Close();
     }
 
     void Close() noexcept {
         if (sockfd != -1) {
+            SPDLOG_LOGGER_INFO(logger, "close socket: {}", sockfd);
             try {
                 int res = close(sockfd);
                 if (res < 0) {
@@ -72,6 +97,11 @@ public:
         }
     }
 
+    // gives up the fd without closing it, for a close done elsewhere
+    int Release() noexcept {
+        return std::exchange(sockfd, -1);
+    }
+
     int get() const {
         return sockfd;
     }
@@ -80,7 +110,9 @@ public:
         return sockfd != -1;
     }
 
-    void listenTo(int port, int max_established_sock) const {
+    // With reuse_port every listener bound to port gets SO_REUSEPORT and the
+    // kernel spreads incoming connections over them.
+    void listenTo(int port, int max_established_sock, bool reuse_port = false) const {
         struct sockaddr_in serverAddr;
         serverAddr.sin_family = AF_INET;
         serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -92,6 +124,9 @@ public:
         if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int)) < 0) {
             throw std::system_error(errno, std::generic_category());
         }
+        if (reuse_port && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int)) < 0) {
+            throw std::system_error(errno, std::generic_category());
+        }
         if (bind(sockfd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
             throw std::system_error(errno, std::generic_category());
         }
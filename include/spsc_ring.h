@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue between exactly one producer and one consumer
+// thread. Head and tail live on cache lines of their own, and each side keeps
+// a private copy of the other side's index, so it only reads the shared one
+// when the ring looks full (producer) or empty (consumer).
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    SpscRing() = default;
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    // producer side, false if the ring is full
+    bool TryPush(const T &item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ == Capacity) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == Capacity) {
+                return false;
+            }
+        }
+        slots_[tail & (Capacity - 1)] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, false if the ring is empty
+    bool TryPop(T &item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        item = slots_[head & (Capacity - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // exact only when called from one of the two threads with the other idle
+    size_t SizeApprox() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+private:
+    // written by the consumer
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;
+    // written by the producer
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;
+    alignas(64) std::array<T, Capacity> slots_{};
+};
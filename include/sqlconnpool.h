@@ -1,34 +1,42 @@
 #pragma once
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <clock.h>
 #include <cstddef>
 #include <memory>
+#include <stop_token>
 #include <string>
 #include <mysql++/mysql++.h>
 #include <mutex>
 #include <condition_variable>
+#include <prepared_statement.h>
+#include <thread>
+#include <utility>
+#include <vector>
 
-class MysqlConnectionPool;
-class MySqlScopedConnection {
+// Database connections, grown on demand up to max_connections and shrunk by
+// closing those idle for max_idle_time. Grab() and Release() are O(1): the
+// idle connections of a shard form an intrusive list in most recently used
+// order, and a grabbed connection carries its slot index back to Release().
+// Handing out the most recently used connection first keeps the others idle,
+// so that they can be reaped; a background thread does that, from the least
+// recently used end, instead of each Grab() walking the pool.
+//
+// The pool may be split into shards, each with its own lock and its share
+// of max_connections. A thread grabs from its own shard, so threads on
+// different cores do not contend on one lock, and takes an idle connection
+// of another shard before it opens a new one.
+class MysqlConnectionPool {
   public:
-    explicit MySqlScopedConnection(MysqlConnectionPool &pool);
-
-    ~MySqlScopedConnection();
-
-    MySqlScopedConnection(MySqlScopedConnection &&) = default;
-    MySqlScopedConnection(const MySqlScopedConnection &) = delete;
-    MySqlScopedConnection &operator=(const MySqlScopedConnection &) = delete;
-    mysqlpp::Connection *operator->() const { return conn_; }
-
-    mysqlpp::Connection &operator*() const { return *conn_; }
+    struct Shard;
 
-  private:
-    MysqlConnectionPool &pool_;
-    mysqlpp::Connection *conn_;
-};
+    // a grabbed connection, handed back to Release()
+    struct Handle {
+        Shard *shard = nullptr;
+        int slot = -1;
+    };
 
-class MysqlConnectionPool {
-  public:
     MysqlConnectionPool() = default;
 
     static MysqlConnectionPool& GetInstance() {
@@ -43,7 +51,8 @@ class MysqlConnectionPool {
         unsigned int port,
         std::chrono::seconds max_idle_time = std::chrono::seconds(3600),
         int initial_connections = 2,
-        int max_connections = 10)
+        int max_connections = 10,
+        int shards = 1)
     {
         db_name_ = std::move(db_name);
         server_ = std::move(server);
@@ -51,111 +60,240 @@ class MysqlConnectionPool {
         password_ = std::move(password);
         port_ = port;
         max_idle_time_ = max_idle_time;
-        initial_connections_ = initial_connections;
-        max_connections_ = max_connections;
-        for (int i = 0; i < initial_connections; i++) {
-            pool_.push_back(ConnectionInfo(Create()));
+        // every shard needs room for a connection
+        shards = std::clamp(shards, 1, std::max(max_connections, 1));
+        for (int i = 0; i < shards; i++) {
+            auto shard = std::make_unique<Shard>();
+            shard->slots.resize(max_connections / shards + (i < max_connections % shards ? 1 : 0));
+            for (int slot = static_cast<int>(shard->slots.size()) - 1; slot >= 0; slot--) {
+                PushUnused(*shard, slot);
+            }
+            shards_.push_back(std::move(shard));
+        }
+        for (int i = 0; i < initial_connections && i < max_connections; i++) {
+            Shard &shard = *shards_[i % shards];
+            int slot = PopUnused(shard);
+            Open(shard.slots[slot]);
+            PushIdle(shard, slot);
+        }
+        if (max_idle_time_ > std::chrono::seconds(0)) {
+            reaper_ = std::jthread([this](std::stop_token stop) { Reap(stop); });
         }
-        available_connections_ = initial_connections;
     }
 
     ~MysqlConnectionPool() {}
 
-    mysqlpp::Connection *Grab() {
-        std::unique_lock<std::mutex> lock(mutex_);
-        RemoveOldConnections_();
-        cv_.wait(lock, [this] {
-            return available_connections_ > 0
-                   || pool_.size() < max_connections_;
-        });
-        if (mysqlpp::Connection *mru = FindMru()) {
-            available_connections_--;
-            return mru;
+    // Takes an idle connection, of this thread's shard if it has one, else
+    // opens one where there is room and otherwise waits for this thread's
+    // shard. Throws if a new connection cannot be opened.
+    Handle Grab() {
+        size_t home = HomeShard();
+        for (bool open : {false, true}) {
+            for (size_t i = 0; i < shards_.size(); i++) {
+                Shard &shard = *shards_[(home + i) % shards_.size()];
+                // another thread's idle connection is only worth it if its
+                // shard is not busy
+                std::unique_lock<std::mutex> lock(shard.mutex, std::defer_lock);
+                if (i == 0 || open) {
+                    lock.lock();
+                } else if (!lock.try_lock()) {
+                    continue;
+                }
+                if (int slot = PopIdle(shard); slot >= 0) {
+                    return {&shard, slot};
+                }
+                if (open && shard.unused >= 0) {
+                    return Connect(shard, lock);
+                }
+            }
         }
-        if (pool_.size() < max_connections_) {
-            pool_.push_back(ConnectionInfo(Create()));
-            pool_.back().in_use = true;
-            return pool_.back().conn.get();
+        Shard &shard = *shards_[home];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        shard.cv.wait(lock, [&shard] {
+            return shard.idle_head >= 0 || shard.unused >= 0;
+        });
+        if (int slot = PopIdle(shard); slot >= 0) {
+            return {&shard, slot};
         }
-        return nullptr;
+        return Connect(shard, lock);
     }
 
-    void Release(const mysqlpp::Connection *connection) {
+    void Release(Handle handle) {
+        Shard &shard = *handle.shard;
         {
-            std::unique_lock<std::mutex> lock(mutex_);
-            for (auto it = pool_.begin(); it != pool_.end(); it++) {
-                if (it->conn.get() == connection) {
-                    it->in_use = false;
-                    it->last_used = std::chrono::system_clock::now();
-                    available_connections_++;
-                    break;
-                }
-            }
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            shard.slots[handle.slot].last_used = CachedClock::Now();
+            PushIdle(shard, handle.slot);
         }
-        cv_.notify_one();
+        shard.cv.notify_one();
     }
 
+    // open connections, idle or not
     size_t Size() const {
-        std::unique_lock<std::mutex> lock(mutex_);
-        return pool_.size();
+        size_t size = 0;
+        for (auto &shard : shards_) {
+            std::unique_lock<std::mutex> lock(shard->mutex);
+            size += shard->open;
+        }
+        return size;
     }
 
     size_t AvailableConnections() const {
-        std::unique_lock<std::mutex> lock(mutex_);
-        return available_connections_;
+        size_t available = 0;
+        for (auto &shard : shards_) {
+            std::unique_lock<std::mutex> lock(shard->mutex);
+            available += shard->idle;
+        }
+        return available;
     }
 
-
     std::chrono::seconds MaxIdleTime() { return max_idle_time_; }
 
-    // most recently used
-    mysqlpp::Connection *FindMru() {
-        auto mru = std::max_element(pool_.begin(), pool_.end());
-        if (mru != pool_.end() && !mru->in_use) {
-            mru->in_use = true;
-            return mru->conn.get();
-        }
-        return nullptr;
-    }
-
-    void RemoveOldConnections_() {
-        auto it = pool_.begin();
-        while (it != pool_.end()) {
-            if (std::chrono::system_clock::now() - it->last_used
-                >= MaxIdleTime()) {
-                if (!it->in_use) { available_connections_--; }
-                pool_.erase(it++);
-            } else {
-                it++;
-            }
+    // where a connection lives; a grabbed one belongs to its holder, which
+    // may use it without the shard's lock
+    struct Slot {
+        std::unique_ptr<mysqlpp::Connection> conn;
+        // behind a pointer like the connection, whose MYSQL handle it
+        // keeps; declared after it so that the statements close first
+        std::unique_ptr<StatementCache> statements;
+        // monotonic, from the CachedClock of the thread that opened or last
+        // released the connection
+        CachedClock::time_point last_used;
+        // the idle list, or the unused slots through next only
+        int prev = -1;
+        int next = -1;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::condition_variable cv;
+        // sized by Init() and never resized, a Handle indexes it
+        std::vector<Slot> slots;
+        // most and least recently used idle connection
+        int idle_head = -1;
+        int idle_tail = -1;
+        // slots without a connection
+        int unused = -1;
+        size_t idle = 0;
+        size_t open = 0;
+    };
+
+  private:
+    // opens a connection in an unused slot of shard, whose lock is held
+    Handle Connect(Shard &shard, std::unique_lock<std::mutex> &lock) {
+        int slot = PopUnused(shard);
+        lock.unlock();
+        // connecting takes round trips, which the lock need not wait for
+        try {
+            Open(shard.slots[slot]);
+        } catch (...) {
+            lock.lock();
+            PushUnused(shard, slot);
+            shard.open--;
+            lock.unlock();
+            shard.cv.notify_one();
+            throw;
         }
+        return {&shard, slot};
     }
 
-  private:
-    std::unique_ptr<mysqlpp::Connection> Create() {
-        return std::make_unique<mysqlpp::Connection>(
+    void Open(Slot &slot) {
+        slot.conn = std::make_unique<mysqlpp::Connection>(
             db_name_.data(), server_.data(), user_.data(), password_.data(),
             port_);
+        slot.statements = std::make_unique<StatementCache>(slot.conn->driver()->mysql_handle());
+        // idle from now on, not since the epoch, as far as the reaper knows
+        slot.last_used = CachedClock::Now();
     }
 
-    struct ConnectionInfo {
-        std::unique_ptr<mysqlpp::Connection> conn;
-        std::chrono::system_clock::time_point last_used =
-            std::chrono::system_clock::now();
-        bool in_use = false;
-
-        ConnectionInfo(std::unique_ptr<mysqlpp::Connection> connection)
-            : conn(std::move(connection)) {}
-        ConnectionInfo(const ConnectionInfo &) = delete;
-        ConnectionInfo &operator=(const ConnectionInfo &) = delete;
-        ConnectionInfo(ConnectionInfo &&) = default;
-        ConnectionInfo &operator=(ConnectionInfo &&) = default;
-        bool operator<(const ConnectionInfo &rhs) const {
-            const ConnectionInfo &lhs = *this;
-            return lhs.in_use == rhs.in_use ? lhs.last_used < rhs.last_used
-                                            : lhs.in_use;
+    // Threads are spread over the shards in the order they first grab a
+    // connection.
+    size_t HomeShard() {
+        thread_local size_t home = next_home_.fetch_add(1, std::memory_order_relaxed);
+        return home % shards_.size();
+    }
+
+    // the following need the shard's lock
+
+    void PushIdle(Shard &shard, int slot) {
+        auto &slots = shard.slots;
+        slots[slot].prev = -1;
+        slots[slot].next = shard.idle_head;
+        if (shard.idle_head >= 0) {
+            slots[shard.idle_head].prev = slot;
+        } else {
+            shard.idle_tail = slot;
         }
-    };
+        shard.idle_head = slot;
+        shard.idle++;
+    }
+
+    // the most recently used idle connection, -1 if there is none
+    int PopIdle(Shard &shard) {
+        int slot = shard.idle_head;
+        if (slot >= 0) {
+            Unlink(shard, slot);
+        }
+        return slot;
+    }
+
+    void Unlink(Shard &shard, int slot) {
+        auto &slots = shard.slots;
+        int prev = slots[slot].prev;
+        int next = slots[slot].next;
+        (prev >= 0 ? slots[prev].next : shard.idle_head) = next;
+        (next >= 0 ? slots[next].prev : shard.idle_tail) = prev;
+        shard.idle--;
+    }
+
+    void PushUnused(Shard &shard, int slot) {
+        shard.slots[slot].next = shard.unused;
+        shard.unused = slot;
+    }
+
+    // a slot for a new connection, which counts as open from now on
+    int PopUnused(Shard &shard) {
+        int slot = shard.unused;
+        shard.unused = shard.slots[slot].next;
+        shard.open++;
+        return slot;
+    }
+
+    // Closes the connections idle for max_idle_time, checking a few times
+    // per max_idle_time.
+    void Reap(std::stop_token stop) {
+        auto period = std::clamp<std::chrono::seconds>(
+            max_idle_time_ / 4, std::chrono::seconds(1), std::chrono::seconds(60));
+        std::mutex mutex;
+        std::condition_variable_any cv;
+        std::unique_lock<std::mutex> wait_lock(mutex);
+        while (true) {
+            cv.wait_for(wait_lock, stop, period, [] { return false; });
+            if (stop.stop_requested()) {
+                return;
+            }
+            for (auto &shard : shards_) {
+                std::vector<Slot> expired;
+                {
+                    auto now = CachedClock::Now();
+                    std::unique_lock<std::mutex> lock(shard->mutex);
+                    while (shard->idle_tail >= 0 &&
+                           now - shard->slots[shard->idle_tail].last_used >= max_idle_time_) {
+                        int slot = shard->idle_tail;
+                        Unlink(*shard, slot);
+                        expired.push_back(std::move(shard->slots[slot]));
+                        PushUnused(*shard, slot);
+                        shard->open--;
+                    }
+                }
+                if (!expired.empty()) {
+                    // the freed slots may let a waiting thread connect
+                    shard->cv.notify_all();
+                }
+                // closed here, outside the lock
+            }
+        }
+    }
 
     std::string db_name_;
     std::string server_;
@@ -163,18 +301,43 @@ class MysqlConnectionPool {
     std::string password_;
     unsigned int port_;
     std::chrono::seconds max_idle_time_;
-    int initial_connections_ = 0;
-    int max_connections_ = 0;
-    int available_connections_ = 0;
-    std::list<ConnectionInfo> pool_;
-    mutable std::mutex mutex_;
-    std::condition_variable cv_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<size_t> next_home_{0};
+    // declared last, so that it is stopped before the shards go
+    std::jthread reaper_;
 };
 
-inline MySqlScopedConnection::MySqlScopedConnection(MysqlConnectionPool &pool)
-    : pool_(pool), conn_(pool.Grab()) {
-}
+class MySqlScopedConnection {
+  public:
+    explicit MySqlScopedConnection(MysqlConnectionPool &pool)
+        : pool_(pool), handle_(pool.Grab()) {}
+
+    ~MySqlScopedConnection() {
+        if (handle_.shard) {
+            pool_.Release(handle_);
+        }
+    }
+
+    // the connection goes back to the pool once, from the moved-to object
+    MySqlScopedConnection(MySqlScopedConnection &&other) noexcept
+        : pool_(other.pool_), handle_(std::exchange(other.handle_, {})) {}
+    MySqlScopedConnection(const MySqlScopedConnection &) = delete;
+    MySqlScopedConnection &operator=(const MySqlScopedConnection &) = delete;
+    mysqlpp::Connection *operator->() const { return Leased().conn.get(); }
+
+    mysqlpp::Connection &operator*() const { return *Leased().conn; }
 
-inline MySqlScopedConnection::~MySqlScopedConnection() {
-    pool_.Release(conn_);
-}
\ No newline at end of file
+    // the statement prepared on this connection, prepared now if it is
+    // used for the first time
+    PreparedStatement &Statement(SQL_STATEMENT id) const {
+        return Leased().statements->Get(id);
+    }
+
+  private:
+    MysqlConnectionPool::Slot &Leased() const {
+        return handle_.shard->slots[handle_.slot];
+    }
+
+    MysqlConnectionPool &pool_;
+    MysqlConnectionPool::Handle handle_;
+};
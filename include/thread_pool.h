@@ -1,23 +1,35 @@
 #pragma once
 #include "socket_descriptor.h"
 #include <cerrno>
+#include <clock.h>
+#include <conn_table.h>
 #include <httpconn.h>
 #include <setting.h>
 #include <logger.h>
-#include <heaptimer.h>
+#include <timing_wheel.h>
 #include <notify_event_fd.h>
 #include <epoller.h>
 #include <spdlog/spdlog.h>
 #include <sys/epoll.h>
-#include <threadsafe_queue.h>
+#include <spsc_ring.h>
 #include <sys/eventfd.h>
 #include <cassert>
 #include <cstddef>
+#include <cstring>
+#include <db_executor.h>
+#include <dispatch_policy.h>
+#include <deque>
 #include <functional>
 #include <mpmc_blocking_q.h>
+#include <optional>
 #include <stdexcept>
 #include <thread>
 #include <vector>
+#ifdef MINISERVER_HAS_IO_URING
+#include <array>
+#include <io_uring_reactor.h>
+#include <poll.h>
+#endif
 enum class async_overflow_policy {
     block,
     overrun_oldest,
@@ -48,37 +60,97 @@ public:
 
 class ServerHandler {
 public:
+    // accepted connections a worker can have waiting before new ones are
+    // turned away with 503
+    static constexpr size_t kHandoffCapacity = 1024;
+    // answers of the DbExecutor a worker can have waiting, past it the
+    // executor's threads wait for the worker
+    static constexpr size_t kVerdictCapacity = 1024;
+
+    // the answer to a connection's UserQuery
+    struct UserVerdict {
+        int fd;
+        uint64_t conn_id;
+        bool verified;
+    };
+
     ServerHandler() = default;
     ServerHandler(const ServerHandler&) = delete;
     ServerHandler& operator=(const ServerHandler&) = delete;
     ServerHandler(ServerHandler&&) = default;
     ServerHandler& operator=(ServerHandler&&) = default;
+    // whether the workers run on io_uring, see Setting::io_backend
+    static bool UseIoUring() {
+#ifdef MINISERVER_HAS_IO_URING
+        return Setting::GetInstance().io_backend == IO_BACKEND::IO_URING;
+#else
+        return false;
+#endif
+    }
+
     void Start() {
        SPDLOG_LOGGER_INFO(logger, "Worker Start!");
+#ifdef MINISERVER_HAS_IO_URING
+        if (UseIoUring()) {
+            RunIoUring();
+            return;
+        }
+#endif
+        CachedClock::Refresh();
         while (true) {
-            int timeMs = Setting::GetInstance().timeout == std::chrono::milliseconds(0) ? -1 : timer.GetNextTick(); 
+            int timeMs = -1;
+            if (Setting::GetInstance().timeout > std::chrono::milliseconds(0)) {
+                // still the reading taken after the last wait; handling the
+                // events took next to no time
+                auto now = CachedClock::Now();
+                timer->Advance(now, [this](int fd) { CloseConn(*conns.Get(fd)); });
+                timeMs = timer->NextTimeoutMs(now);
+            }
             int eventCnt = epoller.Wait(timeMs);
             if (eventCnt < 0) {
                 throw std::system_error(errno, std::generic_category());
             }
+            // the one clock reading of this iteration
+            CachedClock::Refresh();
+            load->events.store(eventCnt, std::memory_order_relaxed);
             for (int i = 0; i < eventCnt; i++) {
-                int fd = epoller.GetEventFd(i);
+                // connections are registered with their HttpConn, the
+                // listener with its socket and the eventfd with nullptr
+                void *ptr = epoller.GetEventPtr(i);
                 uint32_t events = epoller.GetEvents(i);
-                if (fd == notify_event_fd.Get()) {
+                if (ptr == nullptr) {
                     SPDLOG_LOGGER_INFO(logger, "Notify Event");
                     DealNotify();
-                } else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                    assert(user.contains(fd));
-                    SPDLOG_LOGGER_INFO(logger,  "ERROR/CLOSE EVENT: {}", fd);
-                    CloseConn(fd);
+                    continue;
+                }
+                if (ptr == listen_sock.get()) {
+                    SPDLOG_LOGGER_INFO(logger, "LISTEN EVENT");
+                    DealListen();
+                    continue;
+                }
+                auto &client = *static_cast<HttpConn *>(ptr);
+                if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    SPDLOG_LOGGER_INFO(logger,  "ERROR/CLOSE EVENT: {}", client.GetFd());
+                    CloseConn(client);
+                } else if (!Setting::GetInstance().epoll_oneshot) {
+                    // an event carries the socket's current readiness, so
+                    // EPOLLOUT here also means an earlier EAGAIN is over
+                    if (events & EPOLLOUT) {
+                        client.SetWritable(true);
+                    }
+                    if (events & EPOLLIN) {
+                        SPDLOG_LOGGER_INFO(logger, "READ EVENT: {}", client.GetFd());
+                        DealRead(client);
+                    } else if (client.ToWriteBytes() > 0) {
+                        SPDLOG_LOGGER_INFO(logger, "WRITE EVENT: {}", client.GetFd());
+                        DealWrite(client);
+                    }
                 } else if (events & EPOLLIN) {
-                    assert(user.contains(fd));
-                    SPDLOG_LOGGER_INFO(logger, "READ EVENT: {}", fd);
-                    DealRead(fd);
+                    SPDLOG_LOGGER_INFO(logger, "READ EVENT: {}", client.GetFd());
+                    DealRead(client);
                 } else if (events & EPOLLOUT) {
-                    assert(user.contains(fd));
-                    SPDLOG_LOGGER_INFO(logger, "WRITE EVENT: {}", fd);
-                    DealWrite(fd);
+                    SPDLOG_LOGGER_INFO(logger, "WRITE EVENT: {}", client.GetFd());
+                    DealWrite(client);
                 } else {
                     logger->error("Unexpected event");
                 }
@@ -86,76 +158,620 @@ public:
         }
     }
 
+    // Opens this worker's own listening socket for reuse_port mode. Every
+    // worker binds the same port with SO_REUSEPORT and the kernel hashes each
+    // incoming connection to one of them, so connections are accepted on the
+    // thread that serves them. The socket is watched once StartAccepting() is
+    // called.
+    void Listen(int port, int backlog) {
+        listen_sock = std::make_unique<ServerSocket>();
+        listen_sock->listenTo(port, backlog, true);
+    }
+
+    void StartAccepting() {
+        if (!listen_sock) {
+            return;
+        }
+        if (UseIoUring()) {
+            // the ring belongs to the worker, which arms its accept when
+            // woken up
+            notify_event_fd.Write(1);
+        } else {
+            epoller.AddFd(listen_sock->get(), Setting::GetInstance().listen_event, listen_sock.get());
+        }
+    }
+
+    void DealListen() {
+        struct sockaddr_in client_addr;
+        do {
+            socklen_t client_addr_len = sizeof(client_addr);
+            int client_fd = accept4(
+                listen_sock->get(), (struct sockaddr *)&client_addr,
+                &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+                if (errno == EMFILE) {
+                    SPDLOG_LOGGER_ERROR(logger, "The per process limit on the number of open file descriptors has been reached");
+                    return;
+                }
+                throw std::system_error(errno, std::generic_category());
+            }
+            if (HttpConn::user_count >= Setting::GetInstance().MaxFd) {
+                SPDLOG_LOGGER_INFO(logger, "Client is full!");
+                ServerBusy(client_fd);
+                close(client_fd);
+                return;
+            }
+            AddClient({client_fd, client_addr});
+        } while (Setting::GetInstance().listen_event & EPOLLET);
+    }
+
+    // The acceptor and the DbExecutor write the eventfd once per batch, so
+    // the count read here says nothing about how much waits; drain the
+    // queues instead. What is pushed after the drain comes with a write of
+    // its own.
     void DealNotify() {
-        auto num = notify_event_fd.Read();
-        for (auto i = 0; i < num; i++) {
-            auto message = conn_queue.dequeue();
-            AddClient(message.msg);
+        notify_event_fd.Read();
+        Connection conn;
+        while (conn_ring->TryPop(conn)) {
+            load->pending.fetch_sub(1, std::memory_order_relaxed);
+            AddClient(conn);
         }
+        DealVerdicts();
+    }
+
+    // Answers the connections whose user query is back. The connection may
+    // have been closed meanwhile, and its fd taken by another one.
+    void DealVerdicts() {
+        UserVerdict verdict;
+        while (verdicts->try_dequeue(verdict)) {
+            auto *client = conns.Get(verdict.fd);
+            if (client == nullptr || client->Id() != verdict.conn_id || !client->IsParked()) {
+                continue;
+            }
+#ifdef MINISERVER_HAS_IO_URING
+            if (ring) {
+                auto &state = uring_conns[verdict.fd];
+                if (state.closing) {
+                    continue;
+                }
+                if (state.send) {
+                    // the response would go into the buffer the send in
+                    // flight points into
+                    state.verdict = verdict.verified;
+                    continue;
+                }
+                client->Resume(verdict.verified);
+                ProcessRequests(*client);
+                UringSend(*client);
+                continue;
+            }
+#endif
+            client->Resume(verdict.verified);
+            ProcessRequests(*client);
+            if (!Setting::GetInstance().epoll_oneshot) {
+                if (client->IsWritable()) {
+                    Send(*client);
+                }
+            } else {
+                // the connection waits for EPOLLIN, or for EPOLLOUT with a
+                // response still going out, which sends this one too
+                epoller.ModFd(verdict.fd, Setting::GetInstance().conn_event | EPOLLOUT, client);
+            }
+        }
+    }
+
+    // HttpConn::Process(), with a request that needs the user table
+    // answered from the CredentialCache or sent to the DbExecutor. Returns
+    // whether a response was queued.
+    bool ProcessRequests(HttpConn &client) {
+        bool queued = client.Process();
+        while (auto query = client.TakeUserQuery()) {
+            auto verified = HttpRequest::CachedUserVerify(*query);
+            if (!verified) {
+                SubmitUserQuery(client, std::move(*query));
+                break;
+            }
+            client.Resume(*verified);
+            queued = true;
+            client.Process();
+        }
+        return queued;
+    }
+
+    // The worker, and the verdict queue it owns, outlive the executor's
+    // jobs: neither goes away while the server runs.
+    void SubmitUserQuery(HttpConn &client, HttpRequest::UserQuery query) {
+        UserVerdict verdict{client.GetFd(), client.Id(), false};
+        DbExecutor::GetInstance().Submit([this, verdict, query = std::move(query)]() mutable {
+            try {
+                verdict.verified = HttpRequest::UserVerify(query.name, query.password, query.is_login,
+                                                           query.cache_missed);
+            } catch (const std::exception &e) {
+                SPDLOG_LOGGER_ERROR(logger, "user query failed: {}", e.what());
+            }
+            verdicts->enqueue(std::move(verdict));
+            notify_event_fd.Write(1);
+        });
     }
 
     void AddClient(Connection conn) {
         auto [client_fd, client_addr] = conn;
-        auto sock = std::make_unique<ServerSocket>(client_fd);
-        sock->setNonblock();
-        epoller.AddFd(client_fd, Setting::GetInstance().conn_event | EPOLLIN);
-        user[client_fd].Init(std::move(sock), client_addr);
-        if (Setting::GetInstance().timeout > std::chrono::milliseconds(0)) {
-            timer.Add(client_fd, Setting::GetInstance().timeout, [this, client_fd] { CloseConn(client_fd); });
-        }
+        // accepted with SOCK_NONBLOCK
+        auto &client = conns.Acquire(client_fd);
+        client.Init(client_fd, client_addr);
+#ifdef MINISERVER_HAS_IO_URING
+        if (ring) {
+            UringState(client_fd) = {};
+            ArmRecv(client_fd);
+        } else
+#endif
+        epoller.AddFd(client_fd, Setting::GetInstance().conn_event | EPOLLIN, &client);
+        load->connections.store(conns.Size(), std::memory_order_relaxed);
+        ExtendTimer(client);
         SPDLOG_LOGGER_INFO(logger, "Client {}:{} in", client_fd, sockaddrToString(client_addr));
     }
 
-    void CloseConn(int fd) {
-        epoller.DelFd(fd);
-        user.erase(fd);
-        if (Setting::GetInstance().timeout > std::chrono::milliseconds(0)) {
-            timer.Del(fd);
+    void CloseConn(HttpConn &client) {
+#ifdef MINISERVER_HAS_IO_URING
+        if (ring) {
+            CloseUringConn(client);
+            return;
         }
+#endif
+        int fd = client.GetFd();
+        epoller.DelFd(fd);
+        timer->Cancel(client.timer_hook);
+        conns.Release(fd);
+        load->connections.store(conns.Size(), std::memory_order_relaxed);
     }
 
-    void DealRead(int fd) {
+    // arms or pushes back the idle timeout of client, O(1)
+    void ExtendTimer(HttpConn &client) {
         if (Setting::GetInstance().timeout > std::chrono::milliseconds(0)) {
-            timer.Extend(fd, Setting::GetInstance().timeout);
+            timer->Schedule(client.timer_hook, client.GetFd(), CachedClock::Now(),
+                            Setting::GetInstance().timeout);
         }
-        auto& client = user[fd];
+    }
+
+    void DealRead(HttpConn &client) {
+        ExtendTimer(client);
         int read_errno = 0;
         auto ret = client.Read(read_errno);
+        if (read_errno == ENOBUFS) {
+            // over the buffer memory limit, shed the connection
+            ServerBusy(client.GetFd());
+            CloseConn(client);
+            return;
+        }
         if (ret <= 0 && (read_errno != EAGAIN || read_errno != EWOULDBLOCK)) {
-            CloseConn(fd);
+            CloseConn(client);
             return;
         }
-        if (client.Process()) {
-            epoller.ModFd(client.GetFd(), Setting::GetInstance().conn_event | EPOLLOUT);
+        bool queued = ProcessRequests(client);
+        if (!Setting::GetInstance().epoll_oneshot) {
+            // write right away unless the socket is known to be full, in
+            // which case the EPOLLOUT edge will come
+            if (client.ToWriteBytes() > 0 && client.IsWritable()) {
+                Send(client);
+            }
+        } else if (queued) {
+            epoller.ModFd(client.GetFd(), Setting::GetInstance().conn_event | EPOLLOUT, &client);
         } else {
-            epoller.ModFd(client.GetFd(), Setting::GetInstance().conn_event | EPOLLIN);
+            epoller.ModFd(client.GetFd(), Setting::GetInstance().conn_event | EPOLLIN, &client);
         }
     }
 
-    void DealWrite(int fd) {
-        if (Setting::GetInstance().timeout > std::chrono::milliseconds(0)) {
-            timer.Extend(fd, Setting::GetInstance().timeout);
-        }
-        int error_no = 0;
-        auto& client = user[fd];
-        auto ret = client.Write(error_no);
-        if (ret < 0) {
-            if (error_no == EAGAIN || error_no == EWOULDBLOCK) {
-                epoller.ModFd(client.GetFd(), Setting::GetInstance().conn_event | EPOLLOUT);
+    void DealWrite(HttpConn &client) {
+        ExtendTimer(client);
+        Send(client);
+    }
+
+    // Writes what client has queued. Pipelined requests left in the read
+    // buffer while the output queue was full are answered before reading
+    // again.
+    void Send(HttpConn &client) {
+        bool oneshot = Setting::GetInstance().epoll_oneshot;
+        do {
+            int error_no = 0;
+            auto ret = client.Write(error_no);
+            if (ret < 0) {
+                if (error_no != EAGAIN && error_no != EWOULDBLOCK) {
+                    CloseConn(client);
+                } else if (oneshot) {
+                    epoller.ModFd(client.GetFd(), Setting::GetInstance().conn_event | EPOLLOUT, &client);
+                } else {
+                    client.SetWritable(false);
+                }
+                return;
+            }
+            client.LogAccess();
+            if (!client.IsKeepAlive()) {
+                CloseConn(client);
+                return;
+            }
+        } while (ProcessRequests(client));
+        client.ReleaseIdleBuffers();
+        if (oneshot) {
+            epoller.ModFd(client.GetFd(), Setting::GetInstance().conn_event | EPOLLIN, &client);
+        }
+    }
+#ifdef MINISERVER_HAS_IO_URING
+    // The same server on io_uring. Connections come in through a multishot
+    // accept (reuse_port) or a read on the eventfd, requests through a
+    // multishot receive into the ring's provided buffers, and responses go
+    // out with a sendmsg; a connection that closes after its last response
+    // is closed on the ring once that is all sent. Everything queued while handling the completions of an
+    // iteration is submitted by the io_uring_enter that waits for the next
+    // ones. File ranges still go out with sendfile(2), behind a poll for
+    // POLLOUT when the socket is full.
+    static constexpr unsigned kUringEntries = 4096;
+    static constexpr uint16_t kRecvBufferGroup = 0;
+    // the provided buffers a worker receives into
+    static constexpr unsigned kRecvBuffers = 1024;
+    static constexpr unsigned kRecvBufferSize = 4096;
+    // entries of one sendmsg, what does not fit goes with the next one
+    static constexpr int kUringIov = 16;
+
+    // the high half of a request's user_data, the fd is the low half
+    enum class URING_OP : uint32_t {
+        ACCEPT,
+        NOTIFY,
+        RECV,
+        SEND,
+        POLL,
+        CLOSE,
+        CANCEL,
+    };
+
+    // what the ring has in flight for a connection
+    struct UringConn {
+        bool recv;
+        bool send;
+        bool poll;
+        bool close;
+        // the close waits for the receive's last completion
+        bool close_after_recv;
+        // no more requests are taken, the connection is released once
+        // nothing is in flight
+        bool closing;
+        // the close on the ring succeeded and the fd is gone
+        bool closed;
+        // the verdict on the parked request, back while a send was in
+        // flight, see UringSent()
+        std::optional<bool> verdict;
+        struct msghdr msg;
+        std::array<struct iovec, kUringIov> iov;
+    };
+
+    static uint64_t UringTag(URING_OP op, int fd) {
+        return (static_cast<uint64_t>(op) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    void RunIoUring() {
+        // created on this thread, the ring's only submitter
+        ring = std::make_unique<IoUringReactor>(kUringEntries);
+        ring->SetupBufferRing(kRecvBufferGroup, kRecvBuffers, kRecvBufferSize);
+        ArmNotify();
+        CachedClock::Refresh();
+        while (true) {
+            int timeMs = -1;
+            if (Setting::GetInstance().timeout > std::chrono::milliseconds(0)) {
+                auto now = CachedClock::Now();
+                timer->Advance(now, [this](int fd) { CloseConn(*conns.Get(fd)); });
+                timeMs = timer->NextTimeoutMs(now);
+            }
+            ring->SubmitAndWait(timeMs);
+            CachedClock::Refresh();
+            unsigned completions = ring->ForEachCompletion([this](const struct io_uring_cqe &cqe) {
+                int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+                switch (static_cast<URING_OP>(cqe.user_data >> 32)) {
+                case URING_OP::ACCEPT: OnUringAccept(cqe); break;
+                case URING_OP::NOTIFY: OnUringNotify(cqe); break;
+                case URING_OP::RECV: OnUringRecv(fd, cqe); break;
+                case URING_OP::SEND: OnUringSend(fd, cqe); break;
+                case URING_OP::POLL: OnUringPoll(fd, cqe); break;
+                case URING_OP::CLOSE: OnUringClose(fd, cqe); break;
+                case URING_OP::CANCEL: break;
+                }
+            });
+            load->events.store(completions, std::memory_order_relaxed);
+        }
+    }
+
+    UringConn &UringState(int fd) {
+        if (static_cast<size_t>(fd) >= uring_conns.size()) {
+            uring_conns.resize(fd + 1);
+        }
+        return uring_conns[fd];
+    }
+
+    void ArmNotify() {
+        ring->Read(notify_event_fd.Get(), &notify_value, sizeof(notify_value),
+                   UringTag(URING_OP::NOTIFY, notify_event_fd.Get()));
+    }
+
+    void ArmRecv(int fd) {
+        ring->RecvMultishot(fd, kRecvBufferGroup, UringTag(URING_OP::RECV, fd));
+        uring_conns[fd].recv = true;
+    }
+
+    // as DealNotify(), with the eventfd already read by the ring
+    void OnUringNotify(const struct io_uring_cqe &cqe) {
+        if (cqe.res < 0 && cqe.res != -EINTR) {
+            throw std::system_error(-cqe.res, std::generic_category());
+        }
+        Connection conn;
+        while (conn_ring->TryPop(conn)) {
+            load->pending.fetch_sub(1, std::memory_order_relaxed);
+            AddClient(conn);
+        }
+        DealVerdicts();
+        if (listen_sock && !uring_accepting) {
+            SPDLOG_LOGGER_INFO(logger, "accept on io_uring: {}", listen_sock->get());
+            ring->AcceptMultishot(listen_sock->get(), UringTag(URING_OP::ACCEPT, listen_sock->get()));
+            uring_accepting = true;
+        }
+        ArmNotify();
+    }
+
+    void OnUringAccept(const struct io_uring_cqe &cqe) {
+        if (!IoUringReactor::CompletionMore(cqe)) {
+            uring_accepting = false;
+        }
+        if (cqe.res < 0) {
+            if (cqe.res == -EMFILE) {
+                SPDLOG_LOGGER_ERROR(logger, "The per process limit on the number of open file descriptors has been reached");
+            } else {
+                SPDLOG_LOGGER_ERROR(logger, "accept: {}", std::strerror(-cqe.res));
+            }
+        } else if (HttpConn::user_count >= Setting::GetInstance().MaxFd) {
+            SPDLOG_LOGGER_INFO(logger, "Client is full!");
+            ServerBusy(cqe.res);
+            close(cqe.res);
+        } else {
+            // a multishot accept has nowhere to put the peer address
+            struct sockaddr_in client_addr{};
+            socklen_t client_addr_len = sizeof(client_addr);
+            getpeername(cqe.res, (struct sockaddr *)&client_addr, &client_addr_len);
+            AddClient({cqe.res, client_addr});
+        }
+        if (!uring_accepting) {
+            ring->AcceptMultishot(listen_sock->get(), UringTag(URING_OP::ACCEPT, listen_sock->get()));
+            uring_accepting = true;
+        }
+    }
+
+    void OnUringRecv(int fd, const struct io_uring_cqe &cqe) {
+        auto &state = uring_conns[fd];
+        auto &client = *conns.Get(fd);
+        if (!IoUringReactor::CompletionMore(cqe)) {
+            state.recv = false;
+        }
+        bool fed = true;
+        if (int bid = IoUringReactor::CompletionBuffer(cqe); bid >= 0) {
+            if (cqe.res > 0 && !state.closing) {
+                fed = client.Feed(ring->BufferData(bid), cqe.res);
+            }
+            ring->RecycleBuffer(bid);
+        }
+        if (state.closing) {
+            if (!state.recv && state.close_after_recv) {
+                state.close_after_recv = false;
+                QueueUringClose(fd);
+            }
+            FinishUringClose(fd);
+            return;
+        }
+        // ENOBUFS: the provided buffers ran out, receive again below
+        if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+            CloseConn(client);
+            return;
+        }
+        if (!fed) {
+            // over the buffer memory limit, shed the connection
+            ServerBusy(fd);
+            CloseConn(client);
+            return;
+        }
+        // while a send is in flight its iovecs point into the output
+        // buffer, which new responses may move or free; UringSent() takes
+        // up the requests once it is back
+        if (cqe.res > 0) {
+            ExtendTimer(client);
+            if (!state.send) {
+                ProcessRequests(client);
+                UringSend(client);
+            }
+        }
+        if (!state.recv && !state.closing) {
+            ArmRecv(fd);
+        }
+    }
+
+    // queues a send of what client has queued unless one is in flight
+    void UringSend(HttpConn &client) {
+        int fd = client.GetFd();
+        auto &state = uring_conns[fd];
+        if (state.send || state.poll || state.closing || client.ToWriteBytes() == 0) {
+            return;
+        }
+        bool file_follows = false;
+        int iov_cnt = client.GatherWrite(state.iov.data(), kUringIov, file_follows);
+        if (iov_cnt == 0) {
+            // a file range is next, which sendfile(2) sends without a copy
+            int error_no = 0;
+            if (client.Write(error_no) < 0) {
+                if (error_no == EAGAIN || error_no == EWOULDBLOCK) {
+                    ring->PollAdd(fd, POLLOUT, UringTag(URING_OP::POLL, fd));
+                    state.poll = true;
+                } else {
+                    CloseConn(client);
+                }
+                return;
+            }
+            UringSent(client);
+            return;
+        }
+        size_t bytes = 0;
+        for (int i = 0; i < iov_cnt; i++) {
+            bytes += state.iov[i].iov_len;
+        }
+        state.msg = {};
+        state.msg.msg_iov = state.iov.data();
+        state.msg.msg_iovlen = iov_cnt;
+        // with more queued than this send takes, MSG_MORE keeps the tail of
+        // it from going out as a small segment that waits for an ACK
+        bool more = bytes < client.ToWriteBytes();
+        ring->SendMsg(fd, &state.msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0),
+                      UringTag(URING_OP::SEND, fd));
+        state.send = true;
+    }
+
+    // Closes client on the ring once its last response is all out. A send
+    // may come back short, so the close cannot be linked to the send; it is
+    // only queued from here. Completions are found by fd, which the close
+    // hands back for accept to reuse, so a receive still armed is cancelled
+    // first and the close waits for its last completion, see OnUringRecv().
+    void UringCloseSent(HttpConn &client) {
+        int fd = client.GetFd();
+        auto &state = uring_conns[fd];
+        state.closing = true;
+        timer->Cancel(client.timer_hook);
+        if (state.recv) {
+            ring->Cancel(UringTag(URING_OP::RECV, fd), UringTag(URING_OP::CANCEL, fd));
+            state.close_after_recv = true;
+        } else {
+            QueueUringClose(fd);
+        }
+    }
+
+    void QueueUringClose(int fd) {
+        ring->Close(fd, UringTag(URING_OP::CLOSE, fd));
+        uring_conns[fd].close = true;
+    }
+
+    // After a send, with none in flight: answers what came in meanwhile,
+    // then goes on as the loop in Send().
+    void UringSent(HttpConn &client) {
+        auto &state = uring_conns[client.GetFd()];
+        if (state.verdict) {
+            client.Resume(*state.verdict);
+            state.verdict.reset();
+        }
+        ProcessRequests(client);
+        while (client.ToWriteBytes() == 0) {
+            client.LogAccess();
+            if (!client.IsKeepAlive()) {
+                UringCloseSent(client);
+                return;
+            }
+            if (!ProcessRequests(client)) {
+                client.ReleaseIdleBuffers();
+                return;
+            }
+        }
+        UringSend(client);
+    }
+
+    void OnUringSend(int fd, const struct io_uring_cqe &cqe) {
+        auto &state = uring_conns[fd];
+        auto &client = *conns.Get(fd);
+        state.send = false;
+        if (state.closing) {
+            if (cqe.res > 0) {
+                client.Wrote(cqe.res);
+                if (client.ToWriteBytes() == 0) {
+                    client.LogAccess();
+                }
+            }
+            FinishUringClose(fd);
+            return;
+        }
+        if (cqe.res < 0) {
+            if (cqe.res == -EAGAIN) {
+                ring->PollAdd(fd, POLLOUT, UringTag(URING_OP::POLL, fd));
+                state.poll = true;
             } else {
-                CloseConn(client.GetFd());
+                CloseConn(client);
             }
-        } else if (client.IsKeepAlive()) {
-            epoller.ModFd(client.GetFd(), Setting::GetInstance().conn_event | EPOLLIN);
+            return;
+        }
+        client.Wrote(cqe.res);
+        ExtendTimer(client);
+        UringSent(client);
+    }
+
+    void OnUringPoll(int fd, const struct io_uring_cqe &cqe) {
+        auto &state = uring_conns[fd];
+        state.poll = false;
+        if (state.closing) {
+            FinishUringClose(fd);
+        } else if (cqe.res < 0) {
+            CloseConn(*conns.Get(fd));
         } else {
-            CloseConn(client.GetFd());
+            UringSend(*conns.Get(fd));
+        }
+    }
+
+    void OnUringClose(int fd, const struct io_uring_cqe &cqe) {
+        auto &state = uring_conns[fd];
+        state.close = false;
+        state.closed = cqe.res >= 0;
+        FinishUringClose(fd);
+    }
+
+    // cancels what is in flight on client, which is released once it is
+    // all back
+    void CloseUringConn(HttpConn &client) {
+        int fd = client.GetFd();
+        auto &state = uring_conns[fd];
+        if (state.closing) {
+            return;
+        }
+        state.closing = true;
+        timer->Cancel(client.timer_hook);
+        if (state.recv || state.send || state.poll) {
+            ring->CancelFd(fd, UringTag(URING_OP::CANCEL, fd));
         }
+        FinishUringClose(fd);
     }
+
+    void FinishUringClose(int fd) {
+        auto &state = uring_conns[fd];
+        if (state.recv || state.send || state.poll || state.close) {
+            return;
+        }
+        conns.Release(fd, !state.closed);
+        load->connections.store(conns.Size(), std::memory_order_relaxed);
+    }
+
+    // by fd; a deque, so that the msghdr of a send in flight stays put
+    std::deque<UringConn> uring_conns;
+    // only set while the worker runs on io_uring
+    std::unique_ptr<IoUringReactor> ring;
+    // where the ring reads the eventfd to
+    uint64_t notify_value = 0;
+    bool uring_accepting = false;
+#endif
+    // only set in reuse_port mode
+    std::unique_ptr<ServerSocket> listen_sock;
     NotifyEventFd notify_event_fd;
-    threadsafe_queue<async_msg<Connection>> conn_queue;
+    // connections handed over by the acceptor, the only producer
+    std::unique_ptr<SpscRing<Connection, kHandoffCapacity>> conn_ring =
+        std::make_unique<SpscRing<Connection, kHandoffCapacity>>();
+    // filled by the DbExecutor's threads
+    std::unique_ptr<mpmc_blocking_queue<UserVerdict>> verdicts =
+        std::make_unique<mpmc_blocking_queue<UserVerdict>>(kVerdictCapacity);
     Epoller epoller;
-    HeapTimer timer;
-    std::unordered_map<int, HttpConn> user;
+    // behind a pointer as the slot lists point into the wheel; declared
+    // before conns so that connections unlink their timers before it goes
+    std::unique_ptr<TimingWheel> timer =
+        std::make_unique<TimingWheel>(Setting::GetInstance().timer_tick);
+    ConnTable conns;
+    // read by the acceptor's Dispatcher, behind a pointer so that the
+    // handler stays movable
+    std::unique_ptr<WorkerLoad> load = std::make_unique<WorkerLoad>();
 };
 
 class WorkerThread {
@@ -181,9 +797,13 @@ public:
             throw std::runtime_error("invalid threads_n params (range is 1-1000)");
         }
         worker_threads.resize(threads_n);
+        auto &setting = Setting::GetInstance();
         for (size_t i = 0; i < threads_n; i++) {
             auto& current_worker = worker_threads[i];
-            current_worker.serverhandler.epoller.AddFd(current_worker.serverhandler.notify_event_fd.Get(), EPOLLIN);
+            current_worker.serverhandler.epoller.AddFd(current_worker.serverhandler.notify_event_fd.Get(), EPOLLIN, nullptr);
+            if (setting.reuse_port) {
+                current_worker.serverhandler.Listen(setting.port, setting.backlog);
+            }
             current_worker.thread = std::jthread([&current_worker, on_thread_start, on_thread_stop] () {
                 on_thread_start();
                 current_worker.serverhandler.Start(); 
@@ -192,6 +812,13 @@ public:
         }
     }
     
+    // reuse_port mode: let the workers accept on their own listeners
+    void StartAccepting() {
+        for (auto &worker : worker_threads) {
+            worker.serverhandler.StartAccepting();
+        }
+    }
+
     explicit WorkerThreadPool(size_t threads_n)
         : WorkerThreadPool(threads_n, [] {}, [] {}) {}
     
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <clock.h>
+#include <cstddef>
+#include <cstdint>
+
+// Timer node embedded in the object it times, so scheduling never allocates.
+// A node unlinks itself when destroyed; TimingWheel::Cancel() should still be
+// preferred as it keeps the wheel's count exact.
+struct TimerHook {
+    TimerHook() = default;
+    TimerHook(const TimerHook &) = delete;
+    TimerHook &operator=(const TimerHook &) = delete;
+
+    ~TimerHook() {
+        Unlink();
+    }
+
+    bool Linked() const {
+        return next != nullptr;
+    }
+
+    void Unlink() {
+        if (next) {
+            prev->next = next;
+            next->prev = prev;
+            prev = next = nullptr;
+        }
+    }
+
+    // passed to the expiry callback, the fd for connections
+    int id = -1;
+    // tick the timer is due at
+    uint64_t expire = 0;
+    // tick of the slot the node sits in; the node is looked at no later
+    uint64_t slot_expire = 0;
+    TimerHook *prev = nullptr;
+    TimerHook *next = nullptr;
+};
+
+// Hierarchical timing wheel for connection timeouts.
+//
+// Time is counted in coarse ticks and a timer fires in the first tick after
+// it is due, so all timers of a tick expire in one batch. Timers due within
+// 256 ticks sit in a slot of the first level, later ones in one of 64 slots
+// of the three levels above, each covering 64 times the span of the one
+// below; a higher slot is re-sorted into the levels below when the first
+// level wraps around to it. Add, extend and cancel are O(1): pushing a timer
+// further out, what every read and write does to a connection, only updates
+// its due tick and the node is moved when its current slot comes up.
+class TimingWheel {
+public:
+    using Clock = CoarseClock;
+
+    explicit TimingWheel(std::chrono::milliseconds tick, Clock::time_point now = Clock::now())
+        : tick_(tick), origin_(now) {
+        for (auto &level : levels_) {
+            for (auto &slot : level) {
+                slot.prev = slot.next = &slot;
+            }
+        }
+    }
+
+    TimingWheel(const TimingWheel &) = delete;
+    TimingWheel &operator=(const TimingWheel &) = delete;
+
+    // Arms hook to fire timeout after now, or re-arms it if it is armed.
+    void Schedule(TimerHook &hook, int id, Clock::time_point now, std::chrono::milliseconds timeout) {
+        hook.id = id;
+        uint64_t expire = TickAfter(now + timeout);
+        if (hook.Linked()) {
+            if (expire >= hook.slot_expire) {
+                hook.expire = expire;
+                return;
+            }
+            hook.Unlink();
+        } else {
+            count_++;
+        }
+        hook.expire = expire;
+        Place(hook);
+    }
+
+    void Cancel(TimerHook &hook) {
+        if (hook.Linked()) {
+            hook.Unlink();
+            count_--;
+        }
+    }
+
+    // Fires on_expire(id) for every timer due by now. on_expire may schedule
+    // and cancel timers, including its own.
+    template <typename OnExpire>
+    void Advance(Clock::time_point now, OnExpire &&on_expire) {
+        uint64_t target = TickOf(now);
+        if (count_ == 0) {
+            current_ = std::max(current_, target + 1);
+            return;
+        }
+        while (current_ <= target) {
+            uint64_t tick = current_;
+            if ((tick & kLevel0Mask) == 0) {
+                Cascade(tick);
+            }
+            auto &slot = levels_[0][tick & kLevel0Mask];
+            occupied_[(tick & kLevel0Mask) / 64] &= ~(1ull << (tick & 63));
+            // take the slot's list so that timers scheduled for this tick by
+            // on_expire land in the next one instead
+            TimerHook pending;
+            if (slot.next != &slot) {
+                pending.next = slot.next;
+                pending.prev = slot.prev;
+                pending.next->prev = pending.prev->next = &pending;
+                slot.prev = slot.next = &slot;
+            }
+            current_ = tick + 1;
+            while (pending.Linked() && pending.next != &pending) {
+                TimerHook *hook = pending.next;
+                hook->Unlink();
+                if (hook->expire <= tick) {
+                    count_--;
+                    on_expire(hook->id);
+                } else {
+                    Place(*hook);
+                }
+            }
+            pending.prev = pending.next = nullptr;
+            if (count_ == 0) {
+                current_ = target + 1;
+            }
+        }
+    }
+
+    // ms until the wheel may have timers to fire, -1 if it has none
+    int NextTimeoutMs(Clock::time_point now) const {
+        if (count_ == 0) {
+            return -1;
+        }
+        uint64_t next = current_ + kLevel0Slots - (current_ & kLevel0Mask);
+        for (uint64_t tick = current_; tick < next;) {
+            uint64_t idx = tick & kLevel0Mask;
+            uint64_t bits = occupied_[idx / 64] >> (idx & 63);
+            if (bits == 0) {
+                tick += 64 - (idx & 63);
+                continue;
+            }
+            tick += std::countr_zero(bits);
+            if (tick < next) {
+                next = tick;
+            }
+            break;
+        }
+        auto due = origin_ + tick_ * static_cast<int64_t>(next);
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(due - now).count();
+        return ms < 0 ? 0 : static_cast<int>(ms);
+    }
+
+    size_t Size() const {
+        return count_;
+    }
+
+private:
+    static constexpr int kLevel0Bits = 8;
+    static constexpr int kLevelBits = 6;
+    static constexpr int kLevels = 4;
+    static constexpr uint64_t kLevel0Slots = 1ull << kLevel0Bits;
+    static constexpr uint64_t kLevel0Mask = kLevel0Slots - 1;
+    static constexpr uint64_t kLevelMask = (1ull << kLevelBits) - 1;
+    static constexpr uint64_t kMaxSpan = 1ull << (kLevel0Bits + (kLevels - 1) * kLevelBits);
+
+    // the first tick at or after t, so a timer never fires early
+    uint64_t TickAfter(Clock::time_point t) const {
+        auto ticks = (t - origin_ + tick_ - Clock::duration(1)) / tick_;
+        return ticks < 0 ? 0 : static_cast<uint64_t>(ticks);
+    }
+
+    uint64_t TickOf(Clock::time_point t) const {
+        auto ticks = (t - origin_) / tick_;
+        return ticks < 0 ? 0 : static_cast<uint64_t>(ticks);
+    }
+
+    static int Shift(int level) {
+        return level == 0 ? 0 : kLevel0Bits + (level - 1) * kLevelBits;
+    }
+
+    void Place(TimerHook &hook) {
+        uint64_t expire = std::max(hook.expire, current_);
+        uint64_t delta = expire - current_;
+        if (delta >= kMaxSpan) {
+            // beyond the wheel: park in the farthest slot and look again then
+            expire = current_ + kMaxSpan - 1;
+            delta = kMaxSpan - 1;
+        }
+        int level = 0;
+        while (level + 1 < kLevels && delta >= (1ull << Shift(level + 1))) {
+            level++;
+        }
+        uint64_t mask = level == 0 ? kLevel0Mask : kLevelMask;
+        uint64_t idx = (expire >> Shift(level)) & mask;
+        if (level == 0) {
+            occupied_[idx / 64] |= 1ull << (idx & 63);
+            hook.slot_expire = expire;
+        } else {
+            // the slot comes up when the level below wraps around to it
+            hook.slot_expire = (expire >> Shift(level)) << Shift(level);
+        }
+        auto &slot = levels_[level][idx];
+        hook.prev = slot.prev;
+        hook.next = &slot;
+        slot.prev->next = &hook;
+        slot.prev = &hook;
+    }
+
+    // moves the timers of the higher slots that come up at tick, which is a
+    // multiple of the first level's span, into the levels below
+    void Cascade(uint64_t tick) {
+        for (int level = 1; level < kLevels; level++) {
+            auto &slot = levels_[level][(tick >> Shift(level)) & kLevelMask];
+            while (slot.next != &slot) {
+                TimerHook *hook = slot.next;
+                hook->Unlink();
+                Place(*hook);
+            }
+            if (((tick >> Shift(level)) & kLevelMask) != 0) {
+                break;
+            }
+        }
+    }
+
+    Clock::duration tick_;
+    Clock::time_point origin_;
+    // next tick to process
+    uint64_t current_ = 0;
+    size_t count_ = 0;
+    // slot heads, circular lists; level 0 only uses kLevel0Slots of them
+    std::array<std::array<TimerHook, kLevel0Slots>, kLevels> levels_;
+    // non-empty first level slots, a hint: cancelling does not clear bits
+    std::array<uint64_t, kLevel0Slots / 64> occupied_{};
+};
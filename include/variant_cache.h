@@ -0,0 +1,256 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <content_encoding.h>
+#include <cstddef>
+#include <file_cache.h>
+#include <functional>
+#include <list>
+#include <logger.h>
+#include <memory>
+#include <mpmc_blocking_q.h>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+// Process-wide cache of content-coded variants of cached files.
+//
+// A variant is looked up by the path and ETag of the file it encodes, so a new
+// version of the file misses and its stale variants simply age out of the LRU.
+// The first request for a variant uses a precompressed sibling on disk
+// (style.css.br, style.css.gz) if one is at least as new as the file and
+// smaller, and otherwise compresses the file once into memory. Files that do
+// not shrink, have no sibling for a coding the server cannot produce itself
+// or a variant too large for the cache are remembered as such, so a miss
+// costs one lookup as well.
+//
+// A variant is built on a thread of its own, never on a worker's event loop:
+// the first request for it queues the build, marks the key as in flight so
+// that the requests behind it do not queue it again, and is sent identity,
+// like every request until the variant is in.
+class VariantCache {
+public:
+    static constexpr size_t kShards = 8;
+    // below this the coding overhead eats most of the gain
+    static constexpr size_t kMinCompressSize = 256;
+    // builds waiting for the compressing thread; a miss beyond that is sent
+    // identity and queues its build again next time
+    static constexpr size_t kMaxQueuedBuilds = 256;
+
+    static VariantCache &GetInstance() {
+        static VariantCache variant_cache;
+        return variant_cache;
+    }
+
+    VariantCache(const VariantCache &) = delete;
+    VariantCache &operator=(const VariantCache &) = delete;
+
+    void Init(size_t max_bytes, size_t max_compress_size, size_t sendfile_threshold) {
+        max_shard_bytes_ = max_bytes / kShards;
+        max_compress_size_ = max_compress_size;
+        sendfile_threshold_ = sendfile_threshold;
+        builds_ = std::make_unique<mpmc_blocking_queue<std::function<void()>>>(kMaxQueuedBuilds);
+        builder_ = std::jthread([this] { RunBuilds(); });
+    }
+
+    ~VariantCache() {
+        if (builder_.joinable()) {
+            // an empty job stops the thread
+            builds_->enqueue({});
+            builder_.join();
+        }
+    }
+
+    // the preferred variant of identity among the accepted codings (a bit per
+    // CONTENT_ENCODING), nullptr to send identity as it is, also while the
+    // preferred variant is being built
+    std::shared_ptr<const CachedFile> Select(const std::shared_ptr<const CachedFile> &identity,
+                                             unsigned accepted) {
+        if (accepted == 0 || identity->encoding != CONTENT_ENCODING::IDENTITY
+            || !IsCompressible(identity->content_type)) {
+            return nullptr;
+        }
+        for (size_t i = 0; i < kContentEncodingCount; i++) {
+            if (accepted & (1u << i)) {
+                bool building = false;
+                if (auto variant = Get(identity, static_cast<CONTENT_ENCODING>(i), building)) {
+                    return variant;
+                }
+                if (building) {
+                    return nullptr;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    size_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+
+    size_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    size_t Compressions() const { return compressions_.load(std::memory_order_relaxed); }
+
+    size_t Bytes() const {
+        size_t bytes = 0;
+        for (auto &shard : shards_) {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            bytes += shard.bytes;
+        }
+        return bytes;
+    }
+
+private:
+    VariantCache() = default;
+
+    struct Entry {
+        std::string key;
+        // nullptr: identity has no usable variant in this coding, or it
+        // is being built
+        std::shared_ptr<const CachedFile> file;
+        size_t cost;
+        bool building;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+    };
+
+    // The cached variant, or nullptr with building set if it is not in yet.
+    std::shared_ptr<const CachedFile> Get(const std::shared_ptr<const CachedFile> &identity,
+                                          CONTENT_ENCODING encoding, bool &building) {
+        std::string key = identity->path;
+        key += '\n';
+        key += identity->etag;
+        key += '\n';
+        key += kContentEncodingNames[static_cast<size_t>(encoding)];
+        auto &shard = shards_[std::hash<std::string>{}(key) % kShards];
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it != shard.index.end() && !it->second->building) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return it->second->file;
+            }
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            building = true;
+            if (it != shard.index.end()) {
+                return nullptr;
+            }
+            InsertLocked(shard, key, nullptr, key.size(), true);
+        }
+        std::function<void()> build = [this, &shard, key, identity, encoding] {
+            std::shared_ptr<const CachedFile> variant = Build(*identity, encoding);
+            size_t cost = key.size() + (variant ? variant->Cost() : 0);
+            if (cost > max_shard_bytes_) {
+                // too large to keep, identity it is
+                variant.reset();
+                cost = key.size();
+            }
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            InsertLocked(shard, key, std::move(variant), cost, false);
+        };
+        if (!builds_ || !builds_->try_enqueue(build)) {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            Erase(shard, key);
+        }
+        return nullptr;
+    }
+
+    void RunBuilds() {
+        while (true) {
+            std::function<void()> build;
+            builds_->dequeue(build);
+            if (!build) {
+                return;
+            }
+            build();
+        }
+    }
+
+    std::shared_ptr<CachedFile> Build(const CachedFile &identity, CONTENT_ENCODING encoding) {
+        auto suffix = kContentEncodingSuffixes[static_cast<size_t>(encoding)];
+        auto sibling = CachedFile::Load(identity.path + std::string(suffix), sendfile_threshold_);
+        if (sibling && sibling->st.st_mtime >= identity.st.st_mtime && sibling->size < identity.size) {
+            SPDLOG_LOGGER_DEBUG(logger, "variant cache: {} from {}", identity.path, sibling->path);
+            sibling->BecomeVariantOf(identity, encoding);
+            return sibling;
+        }
+        if (identity.size < kMinCompressSize || identity.size > max_compress_size_) {
+            return nullptr;
+        }
+
+        std::string raw;
+        const char *src = identity.data;
+        if (!src) {
+            raw.resize(identity.size);
+            size_t done = 0;
+            while (done < raw.size()) {
+                ssize_t len = pread(identity.fd, raw.data() + done, raw.size() - done, done);
+                if (len <= 0) {
+                    return nullptr;
+                }
+                done += len;
+            }
+            src = raw.data();
+        }
+        auto variant = std::make_shared<CachedFile>();
+        if (!Compress(encoding, src, identity.size, variant->body)) {
+            return nullptr;
+        }
+        compressions_.fetch_add(1, std::memory_order_relaxed);
+        if (variant->body.size() >= identity.size) {
+            return nullptr;
+        }
+        SPDLOG_LOGGER_DEBUG(logger, "variant cache: {} {} -> {} bytes", identity.path,
+                            identity.size, variant->body.size());
+        variant->body.shrink_to_fit();
+        variant->path = identity.path;
+        variant->data = variant->body.data();
+        variant->size = variant->body.size();
+        variant->BecomeVariantOf(identity, encoding);
+        return variant;
+    }
+
+    // the following need the shard's lock
+
+    void InsertLocked(Shard &shard, std::string key, std::shared_ptr<const CachedFile> file,
+                      size_t cost, bool building) {
+        Erase(shard, key);
+        shard.bytes += cost;
+        shard.lru.push_front(Entry{key, std::move(file), cost, building});
+        shard.index.emplace(std::move(key), shard.lru.begin());
+        while (shard.bytes > max_shard_bytes_ && shard.lru.size() > 1) {
+            auto &victim = shard.lru.back();
+            shard.bytes -= victim.cost;
+            shard.index.erase(victim.key);
+            shard.lru.pop_back();
+        }
+    }
+
+    void Erase(Shard &shard, const std::string &key) {
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.bytes -= it->second->cost;
+            shard.lru.erase(it->second);
+            shard.index.erase(it);
+        }
+    }
+
+    std::array<Shard, kShards> shards_;
+    size_t max_shard_bytes_ = (16u << 20) / kShards;
+    size_t max_compress_size_ = 4u << 20;
+    size_t sendfile_threshold_ = 64 * 1024;
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+    std::atomic<size_t> compressions_{0};
+    std::unique_ptr<mpmc_blocking_queue<std::function<void()>>> builds_;
+    std::jthread builder_;
+};
@@ -7,7 +7,13 @@
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <buffer_pool.h>
+#include <credential_cache.h>
+#include <db_executor.h>
+#include <dispatch_policy.h>
 #include <epoller.h>
+#include <file_cache.h>
+#include <variant_cache.h>
 #include <httpconn.h>
 #include <logger.h>
 #include <magic_enum.hpp>
@@ -30,25 +36,47 @@ class WebServer {
   public:
     WebServer()
         : threadpool_(std::make_unique<WorkerThreadPool>(
-            Setting::GetInstance().num_threads)) {
+            Setting::GetInstance().num_threads)),
+          dispatcher_(Setting::GetInstance().dispatch_policy) {
         auto &setting = Setting::GetInstance();
+        for (auto &worker : threadpool_->worker_threads) {
+            worker_loads_.push_back(worker.serverhandler.load.get());
+        }
+        notify_pending_.assign(worker_loads_.size(), false);
         HttpConn::src_dir = setting.work_dir + "/resources";
         HttpConn::isET = Setting::GetInstance().isET;
-        listen_sock_ =
-            std::make_unique<ServerSocket>(ServerSocket::get_new_scoket());
-        listen_sock_->listenTo(setting.port, setting.backlog);
+        // in reuse_port mode the workers accept on listeners of their own
+        // and this thread has nothing to do but wait
+        if (!setting.reuse_port) {
+            listen_sock_ =
+                std::make_unique<ServerSocket>(ServerSocket::get_new_scoket());
+            listen_sock_->listenTo(setting.port, setting.backlog);
 
-        epoller_.AddFd(listen_sock_->get(), setting.listen_event);
+            epoller_.AddFd(listen_sock_->get(), setting.listen_event);
+        }
 
         MysqlConnectionPool::GetInstance().Init(
             setting.db_name, setting.db_server, setting.db_user,
             setting.db_password, setting.db_port, setting.db_max_idle_time,
-            setting.db_initial_connections, setting.db_max_connections);
+            setting.db_initial_connections, setting.db_max_connections,
+            setting.db_pool_shards);
+        DbExecutor::GetInstance().Init(setting.db_max_connections, setting.MaxFd);
+        CredentialCache::GetInstance().Init(
+            setting.credential_cache_entries, setting.credential_cache_ttl);
+        FileCache::GetInstance().Init(
+            setting.file_cache_bytes, setting.file_cache_revalidate,
+            setting.sendfile_threshold, setting.file_cache_fds);
+        VariantCache::GetInstance().Init(
+            setting.variant_cache_bytes, setting.compress_max_file_bytes,
+            setting.sendfile_threshold);
+        BufferPool::SetLimit(setting.buffer_memory_limit);
+        // only now, with everything a request needs set up
+        threadpool_->StartAccepting();
 
         SPDLOG_LOGGER_INFO(logger, "MiniServer Configuration:");
         SPDLOG_LOGGER_INFO(logger, 
-            "port: {}, ET: {}, linger: {}, curSrc: {}", setting.port,
-            setting.isET, setting.optLinger, HttpConn::src_dir);
+            "port: {}, ET: {}, linger: {}, reuse_port: {}, curSrc: {}", setting.port,
+            setting.isET, setting.optLinger, setting.reuse_port, HttpConn::src_dir);
         SPDLOG_LOGGER_INFO(logger, 
             "DB info: name: {}, server: {}, user: {}, port: {}, max_idle_time: {} s, initial connection: {}, max connection: {}",
             setting.db_name, setting.db_server, setting.db_user,
@@ -58,11 +86,46 @@ class WebServer {
             "logLevel: {}, logQueueSize: {}",
             magic_enum::enum_name(logger->level()), setting.logQueSize);
         SPDLOG_LOGGER_INFO(logger, 
-            "SqlConnPool: {}, ThreadPoolNum: {}", setting.db_initial_connections,
-            setting.num_threads);
+            "SqlConnPool: {}, shards: {}, ThreadPoolNum: {}, dispatch: {}", setting.db_initial_connections,
+            setting.db_pool_shards, setting.num_threads, magic_enum::enum_name(setting.dispatch_policy));
+        SPDLOG_LOGGER_INFO(logger,
+            "FileCache: {} MB, {} open files, revalidate: {} ms, sendfile threshold: {} bytes",
+            setting.file_cache_bytes >> 20, FileCache::GetInstance().MaxFds(),
+            setting.file_cache_revalidate.count(), setting.sendfile_threshold);
+        SPDLOG_LOGGER_INFO(logger,
+            "VariantCache: {} MB, compress files up to {} KB",
+            setting.variant_cache_bytes >> 20, setting.compress_max_file_bytes >> 10);
+        SPDLOG_LOGGER_INFO(logger, "Buffer memory limit: {} MB", setting.buffer_memory_limit >> 20);
+        SPDLOG_LOGGER_INFO(logger, "CredentialCache: {} entries, ttl: {} s",
+            setting.credential_cache_entries, setting.credential_cache_ttl.count());
+        if (setting.io_backend == IO_BACKEND::IO_URING && !ServerHandler::UseIoUring()) {
+            SPDLOG_LOGGER_WARN(logger, "built without io_uring, the workers run on epoll");
+        }
+        SPDLOG_LOGGER_INFO(logger, "io backend: {}, epoll oneshot: {}",
+            ServerHandler::UseIoUring() ? "io_uring" : "epoll", setting.epoll_oneshot);
     }
 
-    ~WebServer() { SPDLOG_LOGGER_INFO(logger, "MiniServer End!"); }
+    ~WebServer() {
+        auto &file_cache = FileCache::GetInstance();
+        SPDLOG_LOGGER_INFO(logger,
+            "FileCache hits: {}, misses: {}, evictions: {}, bytes: {}",
+            file_cache.Hits(), file_cache.Misses(), file_cache.Evictions(),
+            file_cache.Bytes());
+        auto &variant_cache = VariantCache::GetInstance();
+        SPDLOG_LOGGER_INFO(logger,
+            "VariantCache hits: {}, misses: {}, compressions: {}, bytes: {}",
+            variant_cache.Hits(), variant_cache.Misses(), variant_cache.Compressions(),
+            variant_cache.Bytes());
+        auto &credential_cache = CredentialCache::GetInstance();
+        SPDLOG_LOGGER_INFO(logger,
+            "CredentialCache hits (db queries saved): {}, misses: {}, hit ratio: {:.2f}, evictions: {}, entries: {}",
+            credential_cache.Hits(), credential_cache.Misses(), credential_cache.HitRatio(),
+            credential_cache.Evictions(), credential_cache.Entries());
+        SPDLOG_LOGGER_INFO(logger,
+            "BufferPool in use: {} bytes, rejections: {}",
+            BufferPool::InUse(), BufferPool::Rejections());
+        SPDLOG_LOGGER_INFO(logger, "MiniServer End!");
+    }
 
     void Main() {
         SPDLOG_LOGGER_INFO(logger, "MiniServer Start!");
@@ -72,7 +135,7 @@ class WebServer {
             for (int i = 0; i < eventCnt; i++) {
                 int fd = epoller_.GetEventFd(i);
                 uint32_t events = epoller_.GetEvents(i);
-                if (fd == listen_sock_->get()) {
+                if (listen_sock_ && fd == listen_sock_->get()) {
                     SPDLOG_LOGGER_INFO(logger, "LISTEN EVENT");
                     DealListen();
                 } else {
@@ -82,65 +145,67 @@ class WebServer {
         }
     }
 
+    // Accepts up to kAcceptBatch connections per round, hands each one to
+    // its worker's ring and then wakes every worker that got any with a single
+    // eventfd write. An edge-triggered listener is drained, a level-triggered
+    // one takes one round per event.
     void DealListen() {
         struct sockaddr_in client_addr;
-        socklen_t client_addr_len = sizeof(client_addr);
+        bool drained = false;
         do {
-            int client_fd = accept(
-                listen_sock_->get(), (struct sockaddr *)&client_addr,
-                &client_addr_len);
-            if (client_fd < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
-                if (errno == EMFILE) {
-                    SPDLOG_LOGGER_ERROR(logger, "The per process limit on the number of open file descriptors has been reached");
-                    return;
+            for (int i = 0; i < kAcceptBatch; i++) {
+                socklen_t client_addr_len = sizeof(client_addr);
+                int client_fd = accept4(
+                    listen_sock_->get(), (struct sockaddr *)&client_addr,
+                    &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (client_fd < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        drained = true;
+                        break;
+                    }
+                    if (errno == EMFILE) {
+                        SPDLOG_LOGGER_ERROR(logger, "The per process limit on the number of open file descriptors has been reached");
+                        drained = true;
+                        break;
+                    }
+                    NotifyWorkers();
+                    throw std::system_error(errno, std::generic_category());
                 }
-                throw std::system_error(errno, std::generic_category());
-            }
-            if (HttpConn::user_count >= Setting::GetInstance().MaxFd) {
-                SPDLOG_LOGGER_INFO(logger, "Client is full!");
-                ServerBusy(client_fd);
-                close(client_fd);
-                return;
+                if (HttpConn::user_count >= Setting::GetInstance().MaxFd) {
+                    SPDLOG_LOGGER_INFO(logger, "Client is full!");
+                    ServerBusy(client_fd);
+                    close(client_fd);
+                    continue;
+                }
+                DispatchConnNew({client_fd, client_addr});
             }
-            DispatchConnNew({client_fd, client_addr});
-        } while (Setting::GetInstance().listen_event & EPOLLET);
+            NotifyWorkers();
+        } while (!drained && (Setting::GetInstance().listen_event & EPOLLET));
     }
 
     void DispatchConnNew(Connection conn) {
-        int worker_id = SelectThreadRoundRobin();
-        auto &worker = threadpool_->worker_threads[worker_id];
-        async_msg<Connection> message(std::move(conn));
-        worker.serverhandler.conn_queue.enqueue(std::move(message));
-        worker.serverhandler.notify_event_fd.Write(1);
-    }
-
-    int SelectThreadRoundRobin() {
-        int tid = (last_thread_ + 1) % Setting::GetInstance().num_threads;
-        last_thread_ = tid;
-        return tid;
+        size_t worker_id = dispatcher_.Select(worker_loads_);
+        auto &handler = threadpool_->worker_threads[worker_id].serverhandler;
+        // counted before the push so the worker never sees it go negative
+        handler.load->pending.fetch_add(1, std::memory_order_relaxed);
+        if (!handler.conn_ring->TryPush(conn)) {
+            handler.load->pending.fetch_sub(1, std::memory_order_relaxed);
+            SPDLOG_LOGGER_WARN(logger, "worker {} has {} connections waiting, reject {}",
+                               worker_id, ServerHandler::kHandoffCapacity, conn.fd);
+            ServerBusy(conn.fd);
+            close(conn.fd);
+            return;
+        }
+        notify_pending_[worker_id] = true;
     }
-    void ServerBusy(int fd) {
-
-        std::string response =  "HTTP/1.1 503 Service Unavailable\r\n"
-                                "Content-Type: text/html; charset=utf-8\r\n"
-                                "Connection: close\r\n"
-                                "\r\n"
-                                "<!DOCTYPE html>\r\n"
-                                "<html lang=\"en\">\r\n"
-                                "<head>\r\n"
-                                "    <meta charset=\"UTF-8\">\r\n"
-                                "    <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\r\n"
-                                "    <title>Service Unavailable</title>\r\n"
-                                "</head>\r\n"
-                                "<body>\r\n"
-                                "    <h1>503 Service Unavailable</h1>\r\n"
-                                "    <p>The server is currently unable to handle the request due to a temporary overload or maintenance of the server. Please try again later.</p>\r\n"
-                                "</body>\r\n"
-                                "</html>\r\n";
 
-        size_t ret = send(fd, response.data(), response.length(), 0);
-        if (ret < 0) { logger->error("send error to client [{}] error!", fd); }
+    void NotifyWorkers() {
+        for (size_t i = 0; i < notify_pending_.size(); i++) {
+            if (notify_pending_[i]) {
+                notify_pending_[i] = false;
+                threadpool_->worker_threads[i].serverhandler.notify_event_fd.Write(1);
+            }
+        }
     }
 
   private:
@@ -149,5 +214,10 @@ class WebServer {
     std::unique_ptr<WorkerThreadPool> threadpool_;
     std::unique_ptr<ServerSocket> listen_sock_;
     Epoller epoller_;
-    int last_thread_ = -1;
+    Dispatcher dispatcher_;
+    std::vector<WorkerLoad *> worker_loads_;
+    // workers that were handed connections since the last NotifyWorkers()
+    std::vector<char> notify_pending_;
+
+    static constexpr int kAcceptBatch = 64;
 };
\ No newline at end of file
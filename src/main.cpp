@@ -13,6 +13,25 @@ int main() {
         10, 12, true, spdlog::level::debug, 1024);
 
     auto& setting = Setting::GetInstance();
+    setting.reuse_port = std::getenv("MINISERVER_REUSE_PORT") != nullptr;
+    // connections registered once, edge-triggered for both directions
+    if (std::getenv("MINISERVER_EPOLL_PERSISTENT")) {
+        setting.epoll_oneshot = false;
+    }
+    setting.InitEventMode();
+    if (auto backend = std::getenv("MINISERVER_IO_BACKEND")) {
+        // EPOLL or IO_URING
+        setting.io_backend =
+            magic_enum::enum_cast<IO_BACKEND>(backend).value_or(setting.io_backend);
+    }
+    if (auto shards = std::getenv("MINISERVER_DB_POOL_SHARDS")) {
+        setting.db_pool_shards = std::atoi(shards);
+    }
+    if (auto policy = std::getenv("MINISERVER_DISPATCH")) {
+        // e.g. POWER_OF_TWO_CHOICES
+        setting.dispatch_policy =
+            magic_enum::enum_cast<DISPATCH_POLICY>(policy).value_or(setting.dispatch_policy);
+    }
     if (!setting.openLog) {
         setting.logLevel = spdlog::level::off;
         logger = spdlog::get("");